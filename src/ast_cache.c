@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast_cache.h"
+#include "env.h"
+#include "plan.h"
+#include "utils.h"
+
+#define INITIAL_BUCKETS		64
+
+/*
+ * A cached line owns the parser context its tree was built in; the
+ * entries are chained in their hash bucket and in the LRU list (most
+ * recently used first).
+ */
+struct ast_entry {
+	struct ast_entry *hash_next;
+	struct ast_entry *lru_prev;
+	struct ast_entry *lru_next;
+	uint64_t hash;
+	parser_ctx_t *ctx;
+	command_t *root;
+	size_t memory;
+	size_t length;
+	char line[];
+};
+
+static struct {
+	struct ast_entry **buckets;
+	size_t nbuckets;
+	struct ast_entry *lru_head;
+	struct ast_entry *lru_tail;
+	size_t budget;
+	/* Context used to parse, it holds the last tree that was not cached. */
+	parser_ctx_t *spare;
+	command_t *spare_root;
+	struct ast_cache_stats stats;
+	bool initialized;
+} cache;
+
+/**
+ * FNV-1a hash of the line bytes.
+ */
+static uint64_t hash_line(const char *line, size_t length)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char)line[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static void cache_init(void)
+{
+	const char *budget = env_getenv("MINISHELL_AST_CACHE");
+
+	cache.budget = budget ? strtoull(budget, NULL, 10) : AST_CACHE_BUDGET;
+	cache.nbuckets = INITIAL_BUCKETS;
+	cache.buckets = calloc(cache.nbuckets, sizeof(*cache.buckets));
+	DIE(cache.buckets == NULL, "Error allocating AST cache.");
+	cache.initialized = true;
+}
+
+static struct ast_entry *cache_find(const char *line, size_t length,
+		uint64_t hash)
+{
+	struct ast_entry *entry = cache.buckets[hash & (cache.nbuckets - 1)];
+
+	for (; entry != NULL; entry = entry->hash_next)
+		if (entry->hash == hash && entry->length == length &&
+			memcmp(entry->line, line, length) == 0)
+			return entry;
+
+	return NULL;
+}
+
+static void lru_unlink(struct ast_entry *entry)
+{
+	if (entry->lru_prev)
+		entry->lru_prev->lru_next = entry->lru_next;
+	else
+		cache.lru_head = entry->lru_next;
+
+	if (entry->lru_next)
+		entry->lru_next->lru_prev = entry->lru_prev;
+	else
+		cache.lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(struct ast_entry *entry)
+{
+	entry->lru_prev = NULL;
+	entry->lru_next = cache.lru_head;
+	if (cache.lru_head)
+		cache.lru_head->lru_prev = entry;
+	else
+		cache.lru_tail = entry;
+	cache.lru_head = entry;
+}
+
+/**
+ * Double the number of buckets once there are more entries than buckets.
+ */
+static void cache_grow(void)
+{
+	size_t nbuckets = cache.nbuckets * 2;
+	struct ast_entry **buckets = calloc(nbuckets, sizeof(*buckets));
+	struct ast_entry *entry;
+	size_t i;
+
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < cache.nbuckets; i++)
+		while ((entry = cache.buckets[i]) != NULL) {
+			cache.buckets[i] = entry->hash_next;
+			entry->hash_next = buckets[entry->hash & (nbuckets - 1)];
+			buckets[entry->hash & (nbuckets - 1)] = entry;
+		}
+
+	free(cache.buckets);
+	cache.buckets = buckets;
+	cache.nbuckets = nbuckets;
+}
+
+/**
+ * Drop the least recently used line; its context is kept for the next
+ * parse if there is no spare one.
+ */
+static void cache_evict(void)
+{
+	struct ast_entry *entry = cache.lru_tail;
+	struct ast_entry **link = &cache.buckets[entry->hash & (cache.nbuckets - 1)];
+
+	while (*link != entry)
+		link = &(*link)->hash_next;
+	*link = entry->hash_next;
+	lru_unlink(entry);
+	plan_release(entry->root);
+
+	if (cache.spare == NULL) {
+		free_parse_memory_r(entry->ctx);
+		cache.spare = entry->ctx;
+	} else {
+		parser_ctx_destroy(entry->ctx);
+	}
+
+	cache.stats.entries--;
+	cache.stats.memory -= entry->memory;
+	cache.stats.evictions++;
+	free(entry);
+}
+
+bool ast_cache_parse(const char *line, size_t length, command_t **root)
+{
+	struct ast_entry *entry;
+	parser_ctx_t *ctx;
+	uint64_t hash;
+	size_t memory;
+
+	if (!cache.initialized)
+		cache_init();
+
+	*root = NULL;
+	hash = hash_line(line, length);
+
+	entry = cache_find(line, length, hash);
+	if (entry != NULL) {
+		cache.stats.hits++;
+		lru_unlink(entry);
+		lru_push_front(entry);
+		*root = entry->root;
+		return true;
+	}
+
+	cache.stats.misses++;
+
+	if (cache.spare == NULL)
+		cache.spare = parser_ctx_create();
+	ctx = cache.spare;
+
+	/* The tree the spare holds goes away, and the plans of its commands. */
+	plan_release(cache.spare_root);
+	cache.spare_root = NULL;
+
+	if (!parse_line_r(ctx, line, length, root))
+		return false;
+	cache.spare_root = *root;
+
+	/*
+	 * Empty lines, trees larger than the whole budget and the ones with
+	 * here-documents (their bodies come from the next lines) are not kept.
+	 */
+	memory = sizeof(*entry) + length + parser_ctx_memory(ctx);
+	if (*root == NULL || memory > cache.budget ||
+		parse_heredoc_pending_r(ctx))
+		return true;
+
+	entry = malloc(sizeof(*entry) + length);
+	if (entry == NULL)
+		return true;
+
+	/* The tree now belongs to the entry, evictions may refill the spare. */
+	cache.spare = NULL;
+	cache.spare_root = NULL;
+	while (cache.stats.memory + memory > cache.budget)
+		cache_evict();
+
+	entry->hash = hash;
+	entry->ctx = ctx;
+	entry->root = *root;
+	entry->memory = memory;
+	entry->length = length;
+	memcpy(entry->line, line, length);
+
+	entry->hash_next = cache.buckets[hash & (cache.nbuckets - 1)];
+	cache.buckets[hash & (cache.nbuckets - 1)] = entry;
+	lru_push_front(entry);
+
+	cache.stats.entries++;
+	cache.stats.memory += memory;
+	if (cache.stats.entries > cache.nbuckets)
+		cache_grow();
+
+	return true;
+}
+
+bool ast_cache_heredoc_pending(void)
+{
+	return cache.spare != NULL && cache.spare_root != NULL &&
+		parse_heredoc_pending_r(cache.spare);
+}
+
+bool ast_cache_heredoc_line(const char *line, size_t length)
+{
+	return parse_heredoc_line_r(cache.spare, line, length);
+}
+
+const struct ast_cache_stats *ast_cache_get_stats(void)
+{
+	return &cache.stats;
+}
@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _AST_CACHE_H
+#define _AST_CACHE_H
+
+#include "../util/parser/parser.h"
+
+/* Default memory budget of the cache, overridden by MINISHELL_AST_CACHE. */
+#define AST_CACHE_BUDGET	(8 << 20)
+
+struct ast_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t entries;
+	size_t memory;
+};
+
+/**
+ * Parse a line, reusing the tree of an identical line parsed before.
+ * The tree must not be modified and is valid until the next call.
+ */
+bool ast_cache_parse(const char *line, size_t length, command_t **root);
+
+/**
+ * Whether the last tree has here-documents still waiting for their lines.
+ */
+bool ast_cache_heredoc_pending(void);
+
+/**
+ * Give the next line of the input to the pending here-document of the
+ * last tree; returns whether more lines are needed.
+ */
+bool ast_cache_heredoc_line(const char *line, size_t length);
+
+/**
+ * Get the hit/miss counters of the cache.
+ */
+const struct ast_cache_stats *ast_cache_get_stats(void);
+
+#endif /* _AST_CACHE_H */
@@ -0,0 +1,30 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Builtin benchmark: runs a script of N (default 100000) `true` lines,
+# which mini-shell runs in process, and one of N `/bin/true` lines, which
+# it has to launch, and prints the time per command of each.
+#
+# Usage: bench/bench_builtins.sh [N] [SHELL]
+
+N=${1:-100000}
+SH=${2:-./mini-shell}
+SCRIPT=$(mktemp)
+trap 'rm -f "$SCRIPT"' EXIT
+
+now() {
+	date +%s.%N
+}
+
+for cmd in true /bin/true; do
+	yes "$cmd" | head -n "$N" > "$SCRIPT"
+
+	start=$(now)
+	$SH "$SCRIPT" || exit 1
+	end=$(now)
+
+	echo "$start $end" | awk -v cmd="$cmd" -v n="$N" '{
+		t = $2 - $1
+		printf "%-10s %8d runs %8.2f s %10.2f us/run\n", cmd, n, t, t / n * 1e6
+	}'
+done
@@ -0,0 +1,110 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Variable store benchmark: times assignments, lookups of set and unset
+ * variables and the envp rebuild with 10, 1000 and 100000 variables (or
+ * the counts given on the command line), next to getenv over an environ
+ * of the same size, which scans it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "env.h"
+#include "utils.h"
+
+#define LOOKUPS		1000000
+/* getenv is linear, it gets fewer rounds on large environments. */
+#define GETENV_WORK	200000000UL
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *var_name(size_t i)
+{
+	char *name = malloc(32);
+
+	DIE(name == NULL, "malloc");
+	snprintf(name, 32, "BENCH_VAR_%zu", i);
+	return name;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t default_counts[] = { 10, 1000, 100000 };
+	size_t ncounts = argc > 1 ? (size_t)argc - 1 : 3;
+	extern char **environ;
+	char **names = NULL, **entries = NULL, **saved = environ;
+	size_t i, j, count, set = 0, rounds;
+	volatile const char *sink;
+	double start, t_set, t_hit, t_miss, t_envp, t_getenv;
+
+	env_init();
+
+	for (i = 0; i < ncounts; i++) {
+		count = argc > 1 ? strtoull(argv[i + 1], NULL, 10) :
+			default_counts[i];
+
+		names = realloc(names, count * sizeof(*names));
+		entries = realloc(entries, (count + 1) * sizeof(*entries));
+		DIE(names == NULL || entries == NULL, "realloc");
+
+		/* Each count adds its variables to the ones already set. */
+		start = now();
+		for (j = set; j < count; j++) {
+			names[j] = var_name(j);
+			env_set(names[j], "value");
+		}
+		t_set = count > set ? (now() - start) * 1e9 / (count - set) : 0;
+		if (count > set)
+			set = count;
+
+		start = now();
+		for (j = 0; j < LOOKUPS; j++)
+			sink = env_getenv(names[(j * 7919) % count]);
+		t_hit = (now() - start) * 1e9 / LOOKUPS;
+
+		start = now();
+		for (j = 0; j < LOOKUPS; j++)
+			sink = env_getenv("BENCH_UNSET");
+		t_miss = (now() - start) * 1e9 / LOOKUPS;
+
+		start = now();
+		env_set(names[0], "changed");
+		env_envp();
+		t_envp = (now() - start) * 1e6;
+
+		for (j = 0; j < count; j++) {
+			entries[j] = malloc(strlen(names[j]) + 8);
+			DIE(entries[j] == NULL, "malloc");
+			sprintf(entries[j], "%s=value", names[j]);
+		}
+		entries[count] = NULL;
+
+		rounds = GETENV_WORK / count;
+		if (rounds > LOOKUPS)
+			rounds = LOOKUPS;
+		environ = entries;
+		start = now();
+		for (j = 0; j < rounds; j++)
+			sink = getenv(names[(j * 7919) % count]);
+		t_getenv = (now() - start) * 1e9 / rounds;
+		environ = saved;
+
+		for (j = 0; j < count; j++)
+			free(entries[j]);
+
+		printf("%7zu vars  set %7.1f ns  get %7.1f ns  unset %7.1f ns  envp %9.1f us  getenv %10.1f ns\n",
+			count, t_set, t_hit, t_miss, t_envp, t_getenv);
+	}
+
+	(void)sink;
+	return EXIT_SUCCESS;
+}
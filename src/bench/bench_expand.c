@@ -0,0 +1,156 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Word expansion benchmark: expands words of 1, 10 and 1000 parts (or
+ * the counts given on the command line), alternating literals and
+ * variables, with expand_word and with the two loops it replaced: one
+ * realloc per part (get_word) and two lookups per part, one to size the
+ * result and one to copy it (token_to_string).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "env.h"
+#include "expand.h"
+#include "utils.h"
+
+/* Parts expanded per measure, whatever the size of the words. */
+#define PARTS		20000000UL
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *legacy_value(word_t *part, size_t *length)
+{
+	const char *value;
+
+	if (!part->expand) {
+		*length = part->length;
+		return part->string;
+	}
+
+	value = env_get(part->string, part->length, NULL);
+	if (value == NULL)
+		value = "";
+	*length = strlen(value);
+	return value;
+}
+
+/**
+ * The get_word loop: the string grows by one realloc per part.
+ */
+static char *legacy_get_word(word_t *s)
+{
+	size_t string_length = 0, length;
+	const char *part;
+	char *string = NULL;
+
+	for (; s != NULL; s = s->next_part) {
+		part = legacy_value(s, &length);
+
+		string = realloc(string, string_length + length + 1);
+		DIE(string == NULL, "realloc");
+		memcpy(string + string_length, part, length);
+		string_length += length;
+		string[string_length] = '\0';
+	}
+
+	return string;
+}
+
+/**
+ * The token_to_string loop: every part is resolved twice.
+ */
+static char *legacy_token_to_string(word_t *token)
+{
+	size_t length, value_length = 1, offset = 0;
+	const char *part;
+	word_t *current;
+	char *value;
+
+	for (current = token; current != NULL; current = current->next_part) {
+		legacy_value(current, &length);
+		value_length += length;
+	}
+
+	value = malloc(value_length);
+	DIE(value == NULL, "malloc");
+
+	for (current = token; current != NULL; current = current->next_part) {
+		part = legacy_value(current, &length);
+		memcpy(value + offset, part, length);
+		offset += length;
+	}
+	value[offset] = '\0';
+
+	return value;
+}
+
+/* A word of count parts: "lit" and $BENCH_VAR in turn. */
+static word_t *make_word(size_t count)
+{
+	word_t *parts = calloc(count, sizeof(*parts));
+	size_t i;
+
+	DIE(parts == NULL, "calloc");
+	for (i = 0; i < count; i++) {
+		parts[i].expand = i % 2 == 1;
+		parts[i].string = parts[i].expand ? "BENCH_VAR" : "lit";
+		parts[i].length = strlen(parts[i].string);
+		parts[i].next_part = i + 1 < count ? &parts[i + 1] : NULL;
+	}
+
+	return parts;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t default_counts[] = { 1, 10, 1000 };
+	size_t ncounts = argc > 1 ? (size_t)argc - 1 : 3;
+	struct expansion e = EXPANSION_INIT;
+	double start, t_expand, t_get_word, t_token;
+	size_t i, j, count, rounds;
+	word_t *word;
+
+	env_init();
+	env_set("BENCH_VAR", "a-value");
+
+	for (i = 0; i < ncounts; i++) {
+		count = argc > 1 ? strtoull(argv[i + 1], NULL, 10) :
+			default_counts[i];
+		word = make_word(count);
+		rounds = PARTS / count;
+
+		start = now();
+		for (j = 0; j < rounds; j++) {
+			expansion_reset(&e);
+			expand_word(&e, word, NULL);
+		}
+		t_expand = (now() - start) * 1e9 / rounds;
+
+		start = now();
+		for (j = 0; j < rounds; j++)
+			free(legacy_get_word(word));
+		t_get_word = (now() - start) * 1e9 / rounds;
+
+		start = now();
+		for (j = 0; j < rounds; j++)
+			free(legacy_token_to_string(word));
+		t_token = (now() - start) * 1e9 / rounds;
+
+		printf("%5zu parts  expand_word %10.1f ns  get_word %10.1f ns  token_to_string %10.1f ns\n",
+			count, t_expand, t_get_word, t_token);
+		free(word);
+	}
+
+	expansion_free(&e);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,34 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Pipeline throughput benchmark: pushes GB gigabytes (default 4) through
+#   head -c ... /dev/zero | cat | cat | cat | wc -c
+# in mini-shell and in /bin/sh and prints the time and the rate of each.
+#
+# Usage: bench/bench_pipeline.sh [GB] [SHELL...]
+
+GB=${1:-4}
+[ $# -gt 0 ] && shift
+SHELLS=${*:-"./mini-shell /bin/sh"}
+BYTES=$((GB * 1024 * 1024 * 1024))
+LINE="head -c $BYTES /dev/zero | cat | cat | cat | wc -c"
+
+now() {
+	date +%s.%N
+}
+
+for sh in $SHELLS; do
+	start=$(now)
+	out=$(echo "$LINE" | $sh 2>&1 | tr -dc '0-9')
+	end=$(now)
+
+	if [ "$out" != "$BYTES" ]; then
+		echo "$sh: expected $BYTES bytes, got '$out'" >&2
+		exit 1
+	fi
+
+	echo "$start $end" | awk -v sh="$sh" -v gb="$GB" '{
+		t = $2 - $1
+		printf "%-16s %d GB %8.2f s %8.2f GB/s\n", sh, gb, t, gb / t
+	}'
+done
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Line reader benchmark: reads files made of small, 64 KB and 16 MB lines
+ * with line_reader and with the fgets + realloc + strcat loop it replaced.
+ * The old loop is quadratic in the line length, it is skipped for 16 MB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "line_reader.h"
+#include "utils.h"
+
+#define TOTAL_SIZE	(256 << 20)
+#define CHUNK_SIZE	1024
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * The read_line() loop the shell used before line_reader.
+ */
+static char *legacy_read_line(FILE *in)
+{
+	char *line = NULL;
+	int line_length = 0;
+	char chunk[CHUNK_SIZE];
+	int chunk_length;
+	int endline = 0;
+
+	while (!endline) {
+		if (fgets(chunk, CHUNK_SIZE, in) == NULL)
+			break;
+
+		chunk_length = strlen(chunk);
+		if (chunk[chunk_length - 1] == '\n') {
+			chunk[chunk_length - 1] = 0;
+			endline = 1;
+		}
+
+		line = realloc(line, line_length + CHUNK_SIZE);
+		DIE(line == NULL, "realloc");
+
+		line[line_length] = '\0';
+		strcat(line, chunk);
+
+		line_length += CHUNK_SIZE;
+	}
+
+	return line;
+}
+
+static FILE *make_input(size_t line_size)
+{
+	FILE *file = tmpfile();
+	char *line = malloc(line_size);
+	size_t i;
+
+	DIE(file == NULL || line == NULL, "Error creating the input");
+
+	memset(line, 'a', line_size - 1);
+	line[line_size - 1] = '\n';
+	for (i = 0; i < TOTAL_SIZE / line_size; i++)
+		fwrite(line, 1, line_size, file);
+
+	fflush(file);
+	free(line);
+
+	return file;
+}
+
+static void bench(size_t line_size, int legacy)
+{
+	FILE *file = make_input(line_size);
+	struct line_reader reader;
+	size_t length, lines = 0;
+	double start, elapsed;
+	char *line;
+
+	rewind(file);
+	lseek(fileno(file), 0, SEEK_SET);
+	line_reader_init(&reader, fileno(file));
+	start = now();
+	while (line_reader_next(&reader, &length) != NULL)
+		lines++;
+	elapsed = now() - start;
+	line_reader_destroy(&reader);
+
+	printf("%10zu bytes/line %8zu lines  line_reader %8.1f MB/s",
+		line_size, lines, TOTAL_SIZE / elapsed / 1e6);
+
+	if (legacy) {
+		lseek(fileno(file), 0, SEEK_SET);
+		rewind(file);
+		start = now();
+		while ((line = legacy_read_line(file)) != NULL)
+			free(line);
+		elapsed = now() - start;
+
+		printf("  read_line %8.1f MB/s", TOTAL_SIZE / elapsed / 1e6);
+	}
+
+	printf("\n");
+	fclose(file);
+}
+
+int main(void)
+{
+	bench(64, 1);
+	bench(64 << 10, 1);
+	bench(16 << 20, 0);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Process launch benchmark: starts /bin/true many times with fork and
+ * with posix_spawn (through launch_command) while the process holds
+ * 10 MB, 100 MB and 1 GB of touched memory, to show how the cost of
+ * fork grows with the RSS of the shell. The zygote, forked before the
+ * memory is touched, is measured as well. Other sizes, in MB, can be
+ * given on the command line.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "env.h"
+#include "launch.h"
+#include "utils.h"
+
+#define LAUNCHES	200
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Average time to start and reap one child, in microseconds.
+ */
+static double bench(enum launch_method method)
+{
+	extern char **environ;
+	char *argv[] = { "/bin/true", NULL };
+	int fds[3] = { -1, -1, -1 };
+	double start;
+	pid_t pid;
+	int i;
+
+	launch_method = method;
+	start = now();
+	for (i = 0; i < LAUNCHES; i++) {
+		pid = launch_command(argv[0], argv, environ, fds);
+		DIE(pid < 0, "launch_command");
+		waitpid(pid, NULL, 0);
+	}
+
+	return (now() - start) * 1e6 / LAUNCHES;
+}
+
+int main(int argc, char *argv[])
+{
+	static const size_t default_sizes[] = { 10, 100, 1024 };
+	size_t nsizes = argc > 1 ? (size_t)argc - 1 : 3;
+	size_t i, size;
+	char *memory;
+
+	/* The zygote is forked while the process is still small. */
+	setenv("MINISHELL_LAUNCH", "zygote", 1);
+	env_init();
+	launch_init();
+	DIE(launch_method != LAUNCH_ZYGOTE, "zygote");
+
+	for (i = 0; i < nsizes; i++) {
+		size = argc > 1 ? strtoull(argv[i + 1], NULL, 10) :
+			default_sizes[i];
+
+		/* Touch every page, they all have to be mapped in the child. */
+		memory = mmap(NULL, size << 20, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		DIE(memory == MAP_FAILED, "mmap");
+		memset(memory, 1, size << 20);
+
+		printf("%6zu MB RSS  fork %10.1f us  posix_spawn %10.1f us  zygote %10.1f us\n",
+			size, bench(LAUNCH_FORK), bench(LAUNCH_SPAWN),
+			bench(LAUNCH_ZYGOTE));
+
+		munmap(memory, size << 20);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,696 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/* splice */
+#define _GNU_SOURCE
+
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "cmd.h"
+#include "env.h"
+#include "path_cache.h"
+
+/* Exit code of test for a malformed expression. */
+#define TEST_ERROR	2
+
+/* Bytes asked for per call by cat; the kernel caps it anyway. */
+#define CAT_CHUNK	(1 << 30)
+#define CAT_BUFFER	(128 << 10)
+
+struct builtin {
+	const char *name;
+	builtin_fn fn;
+};
+
+static int builtin_true(int argc, char **argv)
+{
+	return SUCCESS_CODE;
+}
+
+static int builtin_false(int argc, char **argv)
+{
+	return FAILURE_CODE;
+}
+
+/**
+ * Print a character given by a backslash escape; returns the number of
+ * characters of the escape after the backslash, 0 for \c (stop output).
+ */
+static size_t put_escape(const char *s)
+{
+	unsigned int value = 0;
+	size_t i;
+
+	switch (s[0]) {
+	case 'a':	putchar('\a');	return 1;
+	case 'b':	putchar('\b');	return 1;
+	case 'e':	putchar('\033');	return 1;
+	case 'f':	putchar('\f');	return 1;
+	case 'n':	putchar('\n');	return 1;
+	case 'r':	putchar('\r');	return 1;
+	case 't':	putchar('\t');	return 1;
+	case 'v':	putchar('\v');	return 1;
+	case '\\':	putchar('\\');	return 1;
+	case 'c':	return 0;
+	case '0':
+		for (i = 1; i < 4 && s[i] >= '0' && s[i] <= '7'; i++)
+			value = value * 8 + s[i] - '0';
+		putchar(value);
+		return i;
+	case '\0':
+		putchar('\\');
+		return 0;
+	default:
+		putchar('\\');
+		putchar(s[0]);
+		return 1;
+	}
+}
+
+/**
+ * Print a string, expanding its backslash escapes; false if a \c asked
+ * to stop the output.
+ */
+static bool put_escaped(const char *s)
+{
+	size_t skip;
+
+	for (; *s != '\0'; s++) {
+		if (*s != '\\') {
+			putchar(*s);
+			continue;
+		}
+
+		skip = put_escape(s + 1);
+		if (skip == 0)
+			return s[1] == '\0';
+		s += skip;
+	}
+
+	return true;
+}
+
+/**
+ * echo [-neE] [ARG]...: -n drops the new line, -e expands backslash
+ * escapes, -E does not (the default).
+ */
+static int builtin_echo(int argc, char **argv)
+{
+	bool newline = true, escapes = false;
+	const char *flag;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+		for (flag = argv[i] + 1; *flag != '\0'; flag++)
+			if (*flag != 'n' && *flag != 'e' && *flag != 'E')
+				break;
+		if (*flag != '\0')
+			break;
+
+		for (flag = argv[i] + 1; *flag != '\0'; flag++) {
+			if (*flag == 'n')
+				newline = false;
+			else
+				escapes = *flag == 'e';
+		}
+	}
+
+	for (; i < argc; i++) {
+		if (escapes) {
+			if (!put_escaped(argv[i]))
+				return SUCCESS_CODE;
+		} else {
+			fputs(argv[i], stdout);
+		}
+		if (i + 1 < argc)
+			putchar(' ');
+	}
+
+	if (newline)
+		putchar('\n');
+
+	return SUCCESS_CODE;
+}
+
+/**
+ * Convert a printf argument to a number, as printf(1) does: 'c and "c
+ * give the code of the character c.
+ */
+static bool printf_number(const char *arg, long long *value, bool is_signed)
+{
+	char *end;
+
+	if (arg[0] == '\'' || arg[0] == '"') {
+		*value = (unsigned char)arg[1];
+		return true;
+	}
+
+	errno = 0;
+	*value = is_signed ? strtoll(arg, &end, 0) :
+		(long long)strtoull(arg, &end, 0);
+
+	if (errno != 0 || end == arg || *end != '\0') {
+		fprintf(stderr, "printf: %s: invalid number\n", arg);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Print one conversion; spec holds it, from the '%' to the conversion
+ * character. Returns false if the argument was not valid.
+ */
+static bool printf_conversion(char *spec, size_t length, const char *arg)
+{
+	char conversion = spec[length - 1];
+	char format[64];
+	long long number;
+	bool ok = true;
+	double real;
+	char *end;
+
+	/* Room for the ll length modifier. */
+	if (length + 3 > sizeof(format))
+		length = sizeof(format) - 3;
+	memcpy(format, spec, length - 1);
+
+	switch (conversion) {
+	case 'd': case 'i':
+	case 'o': case 'u': case 'x': case 'X':
+		ok = printf_number(arg, &number, conversion == 'd' ||
+			conversion == 'i');
+		memcpy(format + length - 1, "ll", 2);
+		format[length + 1] = conversion;
+		format[length + 2] = '\0';
+		printf(format, number);
+		break;
+
+	case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+		errno = 0;
+		real = strtod(arg, &end);
+		if (*arg != '\0' && (errno != 0 || *end != '\0')) {
+			fprintf(stderr, "printf: %s: invalid number\n", arg);
+			ok = false;
+		}
+		format[length - 1] = conversion;
+		format[length] = '\0';
+		printf(format, real);
+		break;
+
+	case 'c':
+		if (arg[0] != '\0')
+			putchar(arg[0]);
+		break;
+
+	case 'b':
+		put_escaped(arg);
+		break;
+
+	default:
+		format[length - 1] = 's';
+		format[length] = '\0';
+		printf(format, arg);
+		break;
+	}
+
+	return ok;
+}
+
+/**
+ * printf FORMAT [ARG]...: the format is reused while arguments remain,
+ * missing arguments are empty strings (or 0).
+ */
+static int builtin_printf(int argc, char **argv)
+{
+	int arg = 2, ret = SUCCESS_CODE, used;
+	const char *format, *value;
+	char spec[64];
+	size_t length;
+
+	if (argc < 2) {
+		fprintf(stderr, "printf: usage: printf format [arguments]\n");
+		return TEST_ERROR;
+	}
+
+	do {
+		used = arg;
+		for (format = argv[1]; *format != '\0'; format++) {
+			if (*format == '\\') {
+				length = put_escape(format + 1);
+				if (length == 0 && format[1] == 'c')
+					return ret;
+				format += length;
+				continue;
+			}
+			if (*format != '%') {
+				putchar(*format);
+				continue;
+			}
+			if (format[1] == '%') {
+				putchar('%');
+				format++;
+				continue;
+			}
+
+			length = strspn(format + 1, "-+ #0123456789.") + 2;
+			if (format[length - 1] == '\0') {
+				fputs(format, stdout);
+				break;
+			}
+			if (length > sizeof(spec) - 1)
+				length = sizeof(spec) - 1;
+			memcpy(spec, format, length);
+			spec[length] = '\0';
+
+			value = arg < argc ? argv[arg++] : "";
+			if (*value == '\0' && strchr("dioxXuc", spec[length - 1]))
+				value = spec[length - 1] == 'c' ? "" : "0";
+			if (!printf_conversion(spec, length, value))
+				ret = FAILURE_CODE;
+			format += length - 1;
+		}
+	} while (arg < argc && arg > used);
+
+	return ret;
+}
+
+static int builtin_pwd(int argc, char **argv)
+{
+	char buffer[PATH_MAX];
+
+	if (getcwd(buffer, sizeof(buffer)) == NULL) {
+		perror("pwd");
+		return FAILURE_CODE;
+	}
+
+	puts(buffer);
+
+	return SUCCESS_CODE;
+}
+
+/**
+ * export [-n] [NAME[=VALUE]]...: add the variables to the environment of
+ * the commands (-n takes them out); with no arguments the environment is
+ * listed.
+ */
+static int builtin_export(int argc, char **argv)
+{
+	int i, ret = SUCCESS_CODE;
+	char **env, *value;
+	bool exported;
+
+	if (argc == 1) {
+		for (env = env_envp(); *env != NULL; env++) {
+			value = strchr(*env, '=');
+			if (value == NULL)
+				continue;
+			printf("export %.*s=\"%s\"\n", (int)(value - *env), *env,
+				value + 1);
+		}
+		return SUCCESS_CODE;
+	}
+
+	/* export -n NAME... keeps the variables but stops exporting them. */
+	exported = strcmp(argv[1], "-n") != 0;
+
+	for (i = exported ? 1 : 2; i < argc; i++) {
+		value = strchr(argv[i], '=');
+		if (value != NULL)
+			*value = '\0';
+
+		if ((value != NULL && env_set(argv[i], value + 1) < 0) ||
+			env_export(argv[i], exported) < 0) {
+			if (value != NULL)
+				*value = '=';
+			fprintf(stderr, "export: `%s': not a valid identifier\n",
+				argv[i]);
+			ret = FAILURE_CODE;
+			continue;
+		}
+
+		if (strcmp(argv[i], "PATH") == 0)
+			path_cache_reset();
+		/* The arguments may be the literal words of a plan, keep them. */
+		if (value != NULL)
+			*value = '=';
+	}
+
+	return ret;
+}
+
+static bool test_integer(const char *arg, long long *value)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtoll(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0') {
+		fprintf(stderr, "test: %s: integer expression expected\n", arg);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Unary file and string tests; -1 if op is not one of them.
+ */
+static int test_unary(const char *op, const char *arg)
+{
+	struct stat st;
+
+	if (op[0] != '-' || op[1] == '\0' || op[2] != '\0')
+		return -1;
+
+	switch (op[1]) {
+	case 'n':	return arg[0] != '\0';
+	case 'z':	return arg[0] == '\0';
+	case 'e':	return stat(arg, &st) == 0;
+	case 'f':	return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+	case 'd':	return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+	case 'p':	return stat(arg, &st) == 0 && S_ISFIFO(st.st_mode);
+	case 's':	return stat(arg, &st) == 0 && st.st_size > 0;
+	case 'h':
+	case 'L':	return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	case 'r':	return access(arg, R_OK) == 0;
+	case 'w':	return access(arg, W_OK) == 0;
+	case 'x':	return access(arg, X_OK) == 0;
+	default:	return -1;
+	}
+}
+
+/**
+ * Binary string and integer comparisons; -1 if op is not one of them,
+ * -2 if an integer is not valid.
+ */
+static int test_binary(const char *left, const char *op, const char *right)
+{
+	long long a, b;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(left, right) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(left, right) != 0;
+
+	if (op[0] != '-' || strlen(op) != 3)
+		return -1;
+	if (strcmp(op, "-eq") && strcmp(op, "-ne") && strcmp(op, "-lt") &&
+		strcmp(op, "-le") && strcmp(op, "-gt") && strcmp(op, "-ge"))
+		return -1;
+	if (!test_integer(left, &a) || !test_integer(right, &b))
+		return -2;
+
+	if (strcmp(op, "-eq") == 0)
+		return a == b;
+	if (strcmp(op, "-ne") == 0)
+		return a != b;
+	if (strcmp(op, "-lt") == 0)
+		return a < b;
+	if (strcmp(op, "-le") == 0)
+		return a <= b;
+	if (strcmp(op, "-gt") == 0)
+		return a > b;
+	return a >= b;
+}
+
+/**
+ * Evaluate an expression by its number of arguments, as POSIX specifies
+ * for up to four; 1 if true, 0 if false, -1 if malformed.
+ */
+static int test_expression(int argc, char **argv)
+{
+	int ret;
+
+	switch (argc) {
+	case 0:
+		return 0;
+	case 1:
+		return argv[0][0] != '\0';
+	case 2:
+		if (strcmp(argv[0], "!") == 0)
+			return argv[1][0] == '\0';
+		return test_unary(argv[0], argv[1]);
+	case 3:
+		ret = test_binary(argv[0], argv[1], argv[2]);
+		if (ret != -1)
+			return ret == -2 ? -1 : ret;
+		if (strcmp(argv[0], "!") == 0) {
+			ret = test_expression(2, argv + 1);
+			return ret < 0 ? ret : !ret;
+		}
+		if (strcmp(argv[0], "(") == 0 && strcmp(argv[2], ")") == 0)
+			return test_expression(1, argv + 1);
+		return -1;
+	case 4:
+		if (strcmp(argv[0], "!") == 0) {
+			ret = test_expression(3, argv + 1);
+			return ret < 0 ? ret : !ret;
+		}
+		if (strcmp(argv[0], "(") == 0 && strcmp(argv[3], ")") == 0)
+			return test_expression(2, argv + 1);
+		return -1;
+	default:
+		return -1;
+	}
+}
+
+/**
+ * test EXPRESSION, or [ EXPRESSION ]: 0 if true, 1 if false, 2 if the
+ * expression is malformed.
+ */
+static int builtin_test(int argc, char **argv)
+{
+	int ret;
+
+	if (strcmp(argv[0], "[") == 0) {
+		if (strcmp(argv[argc - 1], "]") != 0) {
+			fprintf(stderr, "[: missing `]'\n");
+			return TEST_ERROR;
+		}
+		argc--;
+	}
+
+	ret = test_expression(argc - 1, argv + 1);
+	if (ret < 0) {
+		if (argc > 5)
+			fprintf(stderr, "%s: too many arguments\n", argv[0]);
+		else
+			fprintf(stderr, "%s: syntax error\n", argv[0]);
+		return TEST_ERROR;
+	}
+
+	return ret ? SUCCESS_CODE : FAILURE_CODE;
+}
+
+enum copy_method {
+	COPY_FILE_RANGE,
+	COPY_SENDFILE,
+	COPY_SPLICE,
+	COPY_READ_WRITE
+};
+
+/**
+ * The cheapest way to copy between two descriptors: splice if one is a
+ * pipe, copy_file_range between regular files, sendfile from a regular
+ * file; read and write otherwise.
+ */
+static enum copy_method copy_method(int in, int out)
+{
+	struct stat in_st, out_st;
+
+	if (fstat(in, &in_st) < 0 || fstat(out, &out_st) < 0)
+		return COPY_READ_WRITE;
+
+	if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+		return COPY_SPLICE;
+	if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode))
+		return COPY_FILE_RANGE;
+	if (S_ISREG(in_st.st_mode))
+		return COPY_SENDFILE;
+
+	return COPY_READ_WRITE;
+}
+
+static ssize_t read_write(int in, int out)
+{
+	char buffer[CAT_BUFFER];
+	ssize_t n, written, done;
+
+	n = read(in, buffer, sizeof(buffer));
+	for (done = 0; done < n; done += written) {
+		written = write(out, buffer + done, n - done);
+		if (written < 0)
+			return -1;
+	}
+
+	return n;
+}
+
+/**
+ * Copy in to out until the end of in, without going through user space
+ * when the descriptors allow it; a method the kernel or the file system
+ * refuses before any byte is copied falls back to the next one.
+ */
+static bool copy_fd(int in, int out)
+{
+	enum copy_method method = copy_method(in, out);
+	bool copied = false;
+	ssize_t n;
+
+	for (;;) {
+		switch (method) {
+		case COPY_FILE_RANGE:
+			n = copy_file_range(in, NULL, out, NULL, CAT_CHUNK, 0);
+			break;
+		case COPY_SENDFILE:
+			n = sendfile(out, in, NULL, CAT_CHUNK);
+			break;
+		case COPY_SPLICE:
+			n = splice(in, NULL, out, NULL, CAT_CHUNK, SPLICE_F_MOVE);
+			break;
+		default:
+			n = read_write(in, out);
+			break;
+		}
+
+		if (n == 0)
+			return true;
+		if (n > 0) {
+			copied = true;
+			continue;
+		}
+		if (errno == EINTR)
+			continue;
+
+		/* copy_file_range gives EBADF for an O_APPEND output. */
+		if (copied || method == COPY_READ_WRITE ||
+			(errno != EINVAL && errno != ENOSYS && errno != EXDEV &&
+			errno != EOPNOTSUPP && errno != EBADF))
+			return false;
+
+		method = method == COPY_FILE_RANGE ? COPY_SENDFILE :
+			COPY_READ_WRITE;
+	}
+}
+
+static bool cat_file(const char *name, int in, int out, int err)
+{
+	int fd = strcmp(name, "-") == 0 ? in : open(name, O_RDONLY | O_CLOEXEC);
+	bool copied;
+
+	if (fd < 0) {
+		dprintf(err, "cat: %s: %s\n", name, strerror(errno));
+		return false;
+	}
+
+	/* A reader that went away is not worth a message, as with SIGPIPE. */
+	copied = copy_fd(fd, out);
+	if (!copied && errno != EPIPE)
+		dprintf(err, "cat: %s: %s\n", name, strerror(errno));
+
+	if (fd != in)
+		close(fd);
+
+	return copied;
+}
+
+int cat_files(int argc, char **argv, int in, int out, int err)
+{
+	int i, ret = SUCCESS_CODE;
+	bool files = false;
+
+	for (i = 1; i < argc; i++) {
+		/* -u (unbuffered) is what cat does anyway. */
+		if (strcmp(argv[i], "-u") == 0)
+			continue;
+
+		files = true;
+		if (!cat_file(argv[i], in, out, err))
+			ret = FAILURE_CODE;
+	}
+
+	if (!files && !cat_file("-", in, out, err))
+		ret = FAILURE_CODE;
+
+	return ret;
+}
+
+static int builtin_cat(int argc, char **argv)
+{
+	return cat_files(argc, argv, STDIN_FILENO, STDOUT_FILENO,
+		STDERR_FILENO);
+}
+
+static const struct builtin builtins[] = {
+	{ "[", builtin_test },
+	{ "cat", builtin_cat },
+	{ "echo", builtin_echo },
+	{ "export", builtin_export },
+	{ "false", builtin_false },
+	{ "printf", builtin_printf },
+	{ "pwd", builtin_pwd },
+	{ "test", builtin_test },
+	{ "true", builtin_true },
+};
+
+enum {
+	BUILTIN_BRACKET, BUILTIN_CAT, BUILTIN_ECHO, BUILTIN_EXPORT,
+	BUILTIN_FALSE, BUILTIN_PRINTF, BUILTIN_PWD, BUILTIN_TEST, BUILTIN_TRUE
+};
+
+builtin_fn builtin_lookup(const char *name, size_t length)
+{
+	const struct builtin *b;
+
+	/* The first character and the length pick the only candidate. */
+	switch (name[0]) {
+	case '[':
+		b = &builtins[BUILTIN_BRACKET];
+		break;
+	case 'c':
+		b = &builtins[BUILTIN_CAT];
+		break;
+	case 'e':
+		b = &builtins[length == 4 ? BUILTIN_ECHO : BUILTIN_EXPORT];
+		break;
+	case 'f':
+		b = &builtins[BUILTIN_FALSE];
+		break;
+	case 'p':
+		b = &builtins[length == 3 ? BUILTIN_PWD : BUILTIN_PRINTF];
+		break;
+	case 't':
+		b = &builtins[length == 4 && name[1] == 'e' ?
+			BUILTIN_TEST : BUILTIN_TRUE];
+		break;
+	default:
+		return NULL;
+	}
+
+	if (strlen(b->name) != length || memcmp(b->name, name, length) != 0)
+		return NULL;
+
+	return b->fn;
+}
+
+bool builtin_is_cat(builtin_fn builtin)
+{
+	return builtin == builtin_cat;
+}
+
+bool builtin_is_pure(builtin_fn builtin)
+{
+	return builtin == builtin_echo || builtin == builtin_printf ||
+		builtin == builtin_pwd || builtin == builtin_test ||
+		builtin == builtin_true || builtin == builtin_false;
+}
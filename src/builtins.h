@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _BUILTINS_H
+#define _BUILTINS_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Builtins that run inside the shell process: echo, printf, pwd, true,
+ * false, test, [, export and cat. They get their arguments like main
+ * does and use the standard streams, which the caller redirects around
+ * them.
+ */
+typedef int (*builtin_fn)(int argc, char **argv);
+
+/**
+ * Get the builtin named by the verb (a slice, not null terminated);
+ * NULL if there is none.
+ */
+builtin_fn builtin_lookup(const char *name, size_t length);
+
+/**
+ * Whether the builtin writes only through stdout (stdio) and changes
+ * nothing in the shell: echo, printf, pwd, test, [, true and false. The
+ * output of these can be captured in the shell, without a child.
+ */
+bool builtin_is_pure(builtin_fn builtin);
+
+/**
+ * Whether the builtin is cat, which takes no option but -u: other uses
+ * of cat run /bin/cat.
+ */
+bool builtin_is_cat(builtin_fn builtin);
+
+/**
+ * The cat builtin on any descriptors, so it can also run in a thread of
+ * the shell as a pipeline stage: copies the files (or in, for none or
+ * "-") to out, reporting errors on err.
+ */
+int cat_files(int argc, char **argv, int in, int out, int err);
+
+#endif /* _BUILTINS_H */
@@ -1,16 +1,33 @@
 // SPDX-License-Identifier: BSD-3-Clause
 
+/* pipe2 */
+#define _GNU_SOURCE
+
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include "builtins.h"
 #include "cmd.h"
+#include "env.h"
+#include "expand.h"
+#include "fd_cache.h"
+#include "here.h"
+#include "jobs.h"
+#include "launch.h"
+#include "path_cache.h"
+#include "plan.h"
+#include "reaper.h"
 #include "utils.h"
 
 #define READ		0
@@ -24,36 +41,44 @@ static bool shell_cd(word_t *dir)
 	// Current directory, which will become the old one after cd
 	char buffer[MAX_PATH];
 	char *oldpwd = getcwd(buffer, MAX_PATH);
+	struct expansion words = EXPANSION_INIT;
+	char *path;
+	bool ret;
 
 	if (oldpwd == NULL) {
 		DIE(FAILURE_CODE, "Failed to get current directory");
 		return false;
 	}
 
-	int ret = setenv("OLDPWD", oldpwd, 1);
-
-	if (ret == -1) {
+	if (env_set("OLDPWD", oldpwd) == -1) {
 		DIE(FAILURE_CODE, "Failed to set OLDPWD");
 		return false;  // Return false if setting OLDPWD fails
 	}
 
-	if (dir == NULL || dir->string[0] == '\0' || strcmp(dir->string, "~") == 0) {
-		return chdir(getenv("HOME"));
-	} else if (strcmp(dir->string, "..") == 0) {
-		return chdir("..");
-	} else if (strcmp(dir->string, ".") == 0) {
-		return true;
-	} else if (strcmp(dir->string, "-") == 0) {
-		if (getenv("OLDPWD") == NULL) {
+	// The word parts are not null terminated, build the path first
+	path = dir ? expansion_at(&words, expand_word(&words, dir, NULL)) : NULL;
+
+	if (path == NULL || path[0] == '\0' || strcmp(path, "~") == 0) {
+		ret = chdir(env_getenv("HOME"));
+	} else if (strcmp(path, "..") == 0) {
+		ret = chdir("..");
+	} else if (strcmp(path, ".") == 0) {
+		ret = true;
+	} else if (strcmp(path, "-") == 0) {
+		if (env_getenv("OLDPWD") == NULL) {
+			expansion_free(&words);
 			DIE(FAILURE_CODE, "OLDPWD not set");
 			return false;
 		}
-		return chdir(getenv("OLDPWD"));
-	} else if (access(dir->string, F_OK) == 0) {
-		return chdir(dir->string);
+		ret = chdir(env_getenv("OLDPWD"));
+	} else if (access(path, F_OK) == 0) {
+		ret = chdir(path);
+	} else {
+		ret = true;
 	}
 
-	return true;
+	expansion_free(&words);
+	return ret;
 }
 
 /**
@@ -66,217 +91,279 @@ static int shell_exit(void)
 }
 
 /**
- * Get the value of a token (environment variable or string).
- * If the token has expansion enabled, it will expand it into the environment variable value.
- * Otherwise, it will return the token's string.
+ * Open the file of a redirection (>> files may come from the fd cache).
  */
-static const char *expand_token(word_t *word)
+static int open_redirection(const char *name, int flags)
 {
-	if (word->expand) {
-		// If the word should be expanded (like a variable), get the environment value
-		const char *env_value = getenv(word->string);
+	int fd = fd_cache_open(name, flags);
 
-		if (env_value == NULL)
-			return "";
-		return env_value;
-	}
-	return word->string;
+	if (fd < 0)
+		perror(name);
+
+	return fd;
 }
 
-/**
- * Concatenates the string values of a linked list of tokens into a single string.
- */
-static char *token_to_string(word_t *token)
+static void close_redirections(int fds[3])
 {
-	if (!token)
-		return NULL;
-
-	// Start with the value of the first token
-	const char *first_value = expand_token(token);
-	size_t value_length = strlen(first_value) + 1;  // +1 for null terminator
+	if (fds[STDIN_FILENO] >= 0)
+		close(fds[STDIN_FILENO]);
+	if (fds[STDOUT_FILENO] >= 0)
+		close(fds[STDOUT_FILENO]);
+	if (fds[STDERR_FILENO] >= 0 && fds[STDERR_FILENO] != fds[STDOUT_FILENO])
+		close(fds[STDERR_FILENO]);
+}
 
-	// Count the length of all token parts
-	word_t *current_token = token->next_part;
+/*
+ * Open the files of the in/out/err redirections in the shell, so the
+ * child only has to install them (-1 for the streams that are not
+ * redirected). Output and error going to the same file (&>) share one
+ * descriptor; a here-document or here-string takes the place of the
+ * input file. Returns false, with nothing left open, if a file cannot
+ * be opened.
+ */
+static bool open_redirections(simple_command_t *s, int fds[3])
+{
+	struct plan *plan = plan_get(s);
+	struct expansion names = EXPANSION_INIT;
+	const char *name[3];
+	size_t length[3], offset;
+	int i;
+
+	fds[STDIN_FILENO] = fds[STDOUT_FILENO] = fds[STDERR_FILENO] = -1;
+	plan_io_names(plan, &names, name, length);
+
+	for (i = 0; i < 3; i++) {
+		if (name[i] == NULL)
+			continue;
+
+		if (i == STDERR_FILENO && name[STDOUT_FILENO] != NULL &&
+			length[i] == length[STDOUT_FILENO] &&
+			memcmp(name[i], name[STDOUT_FILENO], length[i]) == 0) {
+			fds[i] = fds[STDOUT_FILENO];
+			continue;
+		}
 
-	while (current_token) {
-		value_length += strlen(expand_token(current_token));
-		current_token = current_token->next_part;
+		fds[i] = open_redirection(name[i], plan->io_flags[i]);
+		if (fds[i] < 0) {
+			expansion_free(&names);
+			close_redirections(fds);
+			return false;
+		}
 	}
 
-	// Allocate memory for the final concatenated string
-	char *value = malloc(value_length);
-
-	if (!value) {
-		DIE(FAILURE_CODE, "Memory allocation failed");
-		return NULL;
+	/* The names are not used anymore, the text may move the buffer. */
+	if (plan->has_here) {
+		if (fds[STDIN_FILENO] >= 0)
+			close(fds[STDIN_FILENO]);
+		offset = expand_word(&names, plan->here, &length[STDIN_FILENO]);
+		fds[STDIN_FILENO] = here_open(&names, offset,
+			length[STDIN_FILENO]);
+		if (fds[STDIN_FILENO] < 0) {
+			expansion_free(&names);
+			close_redirections(fds);
+			return false;
+		}
 	}
 
-	// Copy the first token's value into the allocated string and append the remaining parts
-	memcpy(value, first_value, strlen(first_value) + 1);
+	expansion_free(&names);
+	return true;
+}
 
-	current_token = token->next_part;
+/**
+ * Perform the cd command; its redirection files are still created.
+ */
+static int execute_cd(simple_command_t *s)
+{
+	int fds[3];
 
-	while (current_token) {
-		strcat(value, expand_token(current_token));
-		current_token = current_token->next_part;
-	}
+	if (!open_redirections(s, fds))
+		return FAILURE_CODE;
+	close_redirections(fds);
 
-	return value;
+	return shell_cd(s->params);
 }
 
-/*
- * Checks if there are any redirections to be done and performs them.
- * Returns true if redirection was successful, false otherwise.
+/**
+ * The hash builtin: list the remembered commands, -r forgets them all,
+ * -p PATH NAME remembers PATH for NAME, -s prints the cache counters and
+ * any other argument is a command to look up and remember.
  */
-static bool manage_redirections(simple_command_t *s)
+static int execute_hash(simple_command_t *s)
 {
-	if (!s)
-		return false;
-
-	// Get the file names for input, output, and error redirection
-	char *in_val = s->in ? token_to_string(s->in) : NULL;
-	char *out_val = s->out ? token_to_string(s->out) : NULL;
-	char *err_val = s->err ? token_to_string(s->err) : NULL;
+	const struct path_cache_stats *stats = path_cache_get_stats();
+	int argc, i, out, err, fds[3], ret = SUCCESS_CODE;
+	struct expansion words = EXPANSION_INIT;
+	char **argv;
 
-	bool success = true;
+	if (!open_redirections(s, fds))
+		return FAILURE_CODE;
+	out = fds[STDOUT_FILENO] >= 0 ? fds[STDOUT_FILENO] : STDOUT_FILENO;
+	err = fds[STDERR_FILENO] >= 0 ? fds[STDERR_FILENO] : STDERR_FILENO;
 
-	// Handle Input Redirection (<)
-	if (s->in && in_val) {
-		int in_fd = open(in_val, O_RDONLY);
+	argv = plan_argv(plan_get(s), &words, &argc);
+	fflush(stdout);
 
-		if (in_fd < 0) {
-			DIE(FAILURE_CODE, "Error opening input file for redirection");
-			success = false;
-		} else if (dup2(in_fd, STDIN_FILENO) < 0) {
-			DIE(FAILURE_CODE, "Error redirecting standard input");
-			success = false;
+	if (argc == 1) {
+		path_cache_print(out);
+	} else if (strcmp(argv[1], "-r") == 0) {
+		path_cache_reset();
+	} else if (strcmp(argv[1], "-s") == 0) {
+		dprintf(out, "%lu hits, %lu misses, %lu invalidations, %zu commands\n",
+			stats->hits, stats->misses, stats->invalidations,
+			stats->entries);
+	} else if (strcmp(argv[1], "-p") == 0) {
+		if (argc < 4) {
+			dprintf(err, "hash: usage: hash -p path name\n");
+			ret = FAILURE_CODE;
+		} else {
+			path_cache_pin(argv[3], argv[2]);
 		}
-		close(in_fd);
+	} else {
+		for (i = 1; i < argc; i++)
+			if (path_cache_lookup(argv[i]) == NULL) {
+				dprintf(err, "hash: %s: not found\n", argv[i]);
+				ret = FAILURE_CODE;
+			}
 	}
 
-	// Handle Output Redirection (> or >>)
-	if (s->out && out_val) {
-		int out_fd;
-
-		if (s->io_flags) {  // If append mode (>>)
-			out_fd = open(out_val, O_WRONLY | O_CREAT | O_APPEND, 0644);
-		} else {  // Overwrite mode (>)
-			out_fd = open(out_val, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-		}
+	expansion_free(&words);
+	close_redirections(fds);
 
-		if (out_fd < 0) {
-			DIE(FAILURE_CODE, "Error opening output file for redirection");
-			success = false;
-		} else if (dup2(out_fd, STDOUT_FILENO) < 0) {
-			DIE(FAILURE_CODE, "Error redirecting standard output");
-			success = false;
-		}
-		close(out_fd);
-	}
+	return ret;
+}
 
-	// Handle Error Redirection (2> or 2>>)
-	if (s->err && err_val) {
-		int err_fd;
+/**
+ * Point the standard streams at the redirection files, saving the ones
+ * of the shell in saved (-1 for those left alone).
+ */
+static void redirect_std(const int fds[3], int saved[3])
+{
+	int i;
 
-		if (s->io_flags) {  // If append mode (2>>)
-			err_fd = open(err_val, O_WRONLY | O_CREAT | O_APPEND, 0644);
-		} else {  // Overwrite mode (2>)
-			err_fd = open(err_val, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-		}
+	for (i = 0; i < 3; i++) {
+		saved[i] = -1;
+		if (fds[i] < 0)
+			continue;
 
-		if (err_fd < 0) {
-			DIE(FAILURE_CODE, "Error opening error file for redirection");
-			success = false;
-		} else if (dup2(err_fd, STDERR_FILENO) < 0) {
-			DIE(FAILURE_CODE, "Error redirecting standard error");
-			success = false;
-		}
-		close(err_fd);
+		saved[i] = fcntl(i, F_DUPFD_CLOEXEC, 3);
+		dup2(fds[i], i);
 	}
+}
 
-	// Combined output and error redirection (&>)
-	if (s->out && s->err && strcmp(out_val, err_val) == 0) {
-		int combined_fd = open(out_val, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-
-		if (combined_fd < 0) {
-			DIE(FAILURE_CODE, "Error opening combined output and error file for redirection");
-			success = false;
-		} else if (dup2(combined_fd, STDOUT_FILENO) < 0 || dup2(combined_fd, STDERR_FILENO) < 0) {
-			DIE(FAILURE_CODE, "Error redirecting standard output and error");
-			success = false;
-		}
-		close(combined_fd);
-	}
+static void restore_std(int saved[3])
+{
+	int i;
 
-	free(in_val);
-	free(out_val);
-	free(err_val);
+	for (i = 0; i < 3; i++) {
+		if (saved[i] < 0)
+			continue;
 
-	return success;
+		dup2(saved[i], i);
+		close(saved[i]);
+	}
 }
 
 /**
- * Perform the cd command.	
+ * Run a builtin of builtins.c in the shell process: the redirections
+ * replace the standard streams around it, the ones of the shell are put
+ * back afterwards. A reader of its output that went away must not kill
+ * the shell: SIGPIPE is blocked meanwhile and a pending one is taken, so
+ * that the write only fails with EPIPE (cat then fails, as /bin/cat).
  */
-static int execute_cd(simple_command_t *s)
+static int execute_builtin(simple_command_t *s)
 {
-	int original = dup(STDOUT_FILENO);
-
-	if (original < 0) {
-		DIE(FAILURE_CODE, "Failed to backup STDOUT");
+	const struct timespec now = { 0, 0 };
+	struct plan *plan = plan_get(s);
+	int argc, ret, fds[3], saved[3];
+	struct expansion words = EXPANSION_INIT;
+	sigset_t mask, old;
+	char **argv;
+
+	if (!open_redirections(s, fds))
 		return FAILURE_CODE;
-	}
 
-	if (!manage_redirections(s)) {
-		close(original);
-		return FAILURE_CODE;
-	}
+	argv = plan_argv(plan, &words, &argc);
+	fflush(stdout);
+	redirect_std(fds, saved);
 
-	int cd_result = shell_cd(s->params);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, &old);
 
+	ret = plan->builtin(argc, argv);
+
+	/* The output must be out before the next command writes its own. */
 	fflush(stdout);
+	fflush(stderr);
 
-	if (dup2(original, STDOUT_FILENO) < 0) {
-		DIE(FAILURE_CODE, "Failed to restore STDOUT");
-		close(original);
-		return FAILURE_CODE;
+	if (!sigismember(&old, SIGPIPE)) {
+		while (sigtimedwait(&mask, NULL, &now) == SIGPIPE)
+			;
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
 	}
+	restore_std(saved);
+
+	expansion_free(&words);
+	close_redirections(fds);
 
-	close(original);
-	return cd_result;
+	return ret;
 }
 
 /**
- * Perform an external command.
+ * Start an external command: the arguments are built, the file is
+ * looked up and the redirections opened before the child is started.
+ * in and out are the pipe ends the command reads from and writes to (-1
+ * for none), its own redirections take precedence over them.
+ * Returns the pid of the child, -1 if it could not be started.
  */
-static int execute_external_command(simple_command_t *s)
+static pid_t start_external(simple_command_t *s, int in, int out)
 {
-	pid_t pid = fork();
-
-	char *command_path = get_word(s->verb);
-	int argc;
-	char **argv = get_argv(s, &argc);
+	struct plan *plan = plan_get(s);
+	struct expansion words = EXPANSION_INIT;
+	int argc, fds[3], std[3];
+	const char *path;
+	char **argv;
+	pid_t pid;
+
+	if (!open_redirections(s, fds))
+		return -1;
+	std[STDIN_FILENO] = fds[STDIN_FILENO] >= 0 ? fds[STDIN_FILENO] : in;
+	std[STDOUT_FILENO] = fds[STDOUT_FILENO] >= 0 ? fds[STDOUT_FILENO] : out;
+	std[STDERR_FILENO] = fds[STDERR_FILENO];
+
+	argv = plan_argv(plan, &words, &argc);
+	path = plan_path(plan, argv[0]);
+	pid = path ? launch_command(path, argv, env_envp(), std) : -1;
+
+	/* The remembered file is gone, search PATH again. */
+	if (pid < 0 && path != NULL && path != argv[0] && errno == ENOENT) {
+		path_cache_forget(argv[0]);
+		path = path_cache_lookup(argv[0]);
+		pid = path ? launch_command(path, argv, env_envp(), std) : -1;
+	}
+	close_redirections(fds);
 
-	if (pid == -1) {
-		DIE(FAILURE_CODE, "fork");
-	} else if (pid == 0) {
-		if (!manage_redirections(s))
-			exit(FAILURE_CODE);
+	/* Commands that cannot be run fail quietly, as before. */
+	if (pid < 0 && path != NULL && errno != ENOENT && errno != EACCES &&
+		errno != ENOTDIR && errno != ENOEXEC)
+		perror(argv[0]);
 
-		execvp(command_path, argv);
+	expansion_free(&words);
 
-		// if execvp fails
-		exit(FAILURE_CODE);
-	} else {
-		int status;
+	return pid;
+}
 
-		waitpid(pid, &status, 0);
+/**
+ * Perform an external command.
+ */
+static int execute_external_command(simple_command_t *s)
+{
+	pid_t pid = start_external(s, -1, -1);
 
-		if (WIFEXITED(status))
-			return WEXITSTATUS(status);
-	}
+	if (pid < 0)
+		return FAILURE_CODE;
 
-	return SUCCESS_CODE;
+	return reaper_wait(pid);
 }
 
 /**
@@ -284,66 +371,469 @@ static int execute_external_command(simple_command_t *s)
  */
 static int execute_env_var_assignment(simple_command_t *s)
 {
-	const char *var = s->verb->string;
-	char *new_value = token_to_string(s->verb->next_part->next_part);
-	int ret = setenv(var, new_value, 1);
+	struct expansion value = EXPANSION_INIT;
+	char *var = strndup(s->verb->string, s->verb->length);
+	int ret;
+
+	expand_word(&value, s->verb->next_part->next_part, NULL);
+	ret = env_set(var, expansion_at(&value, 0));
+
+	/* The remembered commands may no longer be the ones PATH finds. */
+	if (strcmp(var, "PATH") == 0)
+		path_cache_reset();
+
+	free(var);
+	expansion_free(&value);
 
 	if (ret == -1) {
-		DIE(FAILURE_CODE, "setenv");
-		free(new_value);
+		DIE(FAILURE_CODE, "env_set");
 		return FAILURE_CODE;
 	}
 
-	free(new_value);
 	return SUCCESS_CODE;
 }
 
+/**
+ * A forked child of the shell neither waits for nor starts the shell's
+ * jobs and children.
+ */
+static void forget_children(void)
+{
+	jobs_forget();
+	reaper_forget();
+	fd_cache_forget();
+}
+
+static int execute_exit(simple_command_t *s)
+{
+	return shell_exit();
+}
+
+/**
+ * Wait for the background jobs.
+ */
+static int execute_wait(simple_command_t *s)
+{
+	jobs_wait();
+
+	return SUCCESS_CODE;
+}
+
+typedef int (*builtin_t)(simple_command_t *s);
+
+/**
+ * Get the function running an internal command or an environment variable
+ * assignment; NULL for external commands.
+ */
+static builtin_t find_builtin(simple_command_t *s)
+{
+	switch (plan_get(s)->kind) {
+	case PLAN_CD:
+		return execute_cd;
+	case PLAN_EXIT:
+		return execute_exit;
+	case PLAN_HASH:
+		return execute_hash;
+	case PLAN_WAIT:
+		return execute_wait;
+	case PLAN_BUILTIN:
+		return execute_builtin;
+	case PLAN_ASSIGNMENT:
+		return execute_env_var_assignment;
+	default:
+		return NULL;
+	}
+}
+
 /**
  * Parse a simple command (internal, environment variable assignment,
  * external command).
  */
 static int parse_simple(simple_command_t *s, int level, command_t *father)
 {
+	builtin_t builtin;
+	int ret;
+
 	if (!s || !s->verb || !s->verb->string)
 		return FAILURE_CODE;
 
 	/* If builtin command, execute the command. */
-	if (strcmp(s->verb->string, "cd") == 0)
-		return execute_cd(s);
+	builtin = find_builtin(s);
+
+	/* If it's not any of the above, it's an external command*/
+	ret = builtin != NULL ? builtin(s) : execute_external_command(s);
+	env_command_done();
+
+	return ret;
+}
+
+/**
+ * Submit a command as background jobs; in a & b & c, parsed as
+ * (a & b) & c, a and b are both jobs of their own.
+ */
+static void run_in_background(command_t *c)
+{
+	if (c->op != OP_PARALLEL) {
+		jobs_submit(c);
+		return;
+	}
+
+	run_in_background(c->cmd1);
+	if (c->cmd2 != NULL)
+		run_in_background(c->cmd2);
+}
+
+/**
+ * Run cmd1 in the background and cmd2, if any (a trailing & leaves it
+ * out), in the foreground.
+ */
+static int run_in_parallel(command_t *c, int level, command_t *father)
+{
+	run_in_background(c->cmd1);
 
-	if (strcmp(s->verb->string, "exit") == 0 || strcmp(s->verb->string, "quit") == 0)
-		return shell_exit();
+	if (c->cmd2 == NULL)
+		return SUCCESS_CODE;
 
+	return parse_command(c->cmd2, level + 1, c);
+}
 
-	/* If variable assignment, execute the assignment */
-	if (s->verb && s->verb->next_part && s->verb->next_part->string && s->verb->next_part->string[0] == '=')
-		return execute_env_var_assignment(s);
+struct stage {
+	simple_command_t *scmd;
+	int status;
+	struct pipeline *pipeline;
 
-	/* If it's not any of the above, it's an external command*/
-	return execute_external_command(s);
+	/* For the stages run in a thread of the shell. */
+	bool threaded;
+	pthread_t thread;
+	int io[3];
+	struct stage *next_running;
+	int argc;
+	char **argv;
+	struct expansion words;
+};
+
+/* The simple commands of a pipeline, from left to right. */
+struct pipeline {
+	struct stage *stages;
+	size_t count;
+	size_t capacity;
+	size_t running;
+	int (*pipes)[2];
+};
+
+static void add_stage(struct pipeline *p, simple_command_t *s)
+{
+	if (p->count == p->capacity) {
+		p->capacity = p->capacity ? 2 * p->capacity : 8;
+		p->stages = realloc(p->stages, p->capacity * sizeof(*p->stages));
+		DIE(p->stages == NULL, "Error allocating pipeline.");
+	}
+
+	memset(&p->stages[p->count], 0, sizeof(p->stages[p->count]));
+	p->stages[p->count].scmd = s;
+	p->stages[p->count].status = FAILURE_CODE;
+	p->stages[p->count++].pipeline = p;
+}
+
+/**
+ * Flatten a pipe subtree; it only holds OP_PIPE and OP_NONE nodes. The
+ * grammar is left associative (a | b | c is (a | b) | c), so the left
+ * spine is walked down and back up without recursion.
+ */
+static void collect_stages(command_t *c, struct pipeline *p)
+{
+	command_t *node = c;
+
+	while (node->op == OP_PIPE)
+		node = node->cmd1;
+	add_stage(p, node->scmd);
+
+	while (node != c) {
+		node = node->up;
+		if (node->cmd2->op == OP_PIPE)
+			collect_stages(node->cmd2, p);
+		else
+			add_stage(p, node->cmd2->scmd);
+	}
+}
+
+static void close_pipes(struct pipeline *p, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		close(p->pipes[i][READ]);
+		close(p->pipes[i][WRITE]);
+	}
+}
+
+/**
+ * Internal commands of a pipeline run in a child of their own, the one
+ * case posix_spawn cannot cover.
+ */
+static pid_t start_builtin(builtin_t builtin, simple_command_t *s,
+		struct pipeline *p, int in, int out)
+{
+	pid_t pid;
+	int ret;
+
+	fflush(NULL);
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	if ((in >= 0 && dup2(in, STDIN_FILENO) < 0) ||
+		(out >= 0 && dup2(out, STDOUT_FILENO) < 0))
+		_exit(FAILURE_CODE);
+	close_pipes(p, p->count - 1);
+	forget_children();
+
+	ret = builtin(s);
+	fflush(NULL);
+	_exit(ret);
+}
+
+static void close_stage_io(struct stage *stage)
+{
+	int i;
+
+	for (i = 0; i < 3; i++)
+		if (stage->io[i] > STDERR_FILENO && (i != STDERR_FILENO ||
+			stage->io[i] != stage->io[STDOUT_FILENO]))
+			close(stage->io[i]);
+}
+
+/*
+ * The descriptors of the cat threads are close-on-exec, but the children
+ * forked to run builtins or subshells never exec: a pipe end they kept
+ * would hold back the EOF of its reader for as long as they run. The
+ * threads that run are listed, and a fork waits for the list to be still
+ * so that the child can close their descriptors.
+ */
+static pthread_mutex_t running_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stage *running_stages;
+
+static void lock_running(void)
+{
+	pthread_mutex_lock(&running_lock);
+}
+
+static void unlock_running(void)
+{
+	pthread_mutex_unlock(&running_lock);
+}
+
+static void close_running(void)
+{
+	struct stage *stage;
+
+	for (stage = running_stages; stage != NULL; stage = stage->next_running)
+		close_stage_io(stage);
+	running_stages = NULL;
+	pthread_mutex_unlock(&running_lock);
+}
+
+static void add_running(struct stage *stage)
+{
+	static bool registered;
+
+	if (!registered) {
+		DIE(pthread_atfork(lock_running, unlock_running,
+			close_running) != 0, "pthread_atfork");
+		registered = true;
+	}
+
+	lock_running();
+	stage->next_running = running_stages;
+	running_stages = stage;
+	unlock_running();
 }
 
 /**
- * Process two commands in parallel, by creating two children.
+ * The descriptors are closed with the stage out of the list, so that a
+ * child never closes a number that was reused.
  */
-static bool run_in_parallel(command_t *cmd1, command_t *cmd2, int level,
-		command_t *father)
+static void remove_running(struct stage *stage)
 {
-	/* Execute cmd1 and cmd2 simultaneously. */
+	struct stage **link;
+
+	lock_running();
+	for (link = &running_stages; *link != stage;
+		link = &(*link)->next_running)
+		;
+	*link = stage->next_running;
+	close_stage_io(stage);
+	unlock_running();
+}
+
+/**
+ * A cat stage copies in the thread; SIGPIPE is blocked there, so a
+ * reader that went away ends the copy instead of the shell.
+ */
+static void *cat_stage(void *arg)
+{
+	struct stage *stage = arg;
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	stage->status = cat_files(stage->argc, stage->argv,
+		stage->io[STDIN_FILENO], stage->io[STDOUT_FILENO],
+		stage->io[STDERR_FILENO]);
+	remove_running(stage);
+
+	return NULL;
+}
+
+/**
+ * The thread gets its own copies of the pipe ends, the shell closes all
+ * of its own once every stage has started.
+ */
+static int stage_fd(int redirection, int pipe_end, int standard)
+{
+	if (redirection >= 0)
+		return redirection;
+	if (pipe_end >= 0)
+		return fcntl(pipe_end, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+
+	return standard;
+}
+
+/**
+ * cat stages run in a thread of the shell rather than in a child, and
+ * move the data with splice or sendfile (see builtins.c).
+ */
+static bool start_cat_thread(struct stage *stage, int in, int out)
+{
+	int fds[3];
+
+	/* $(...) parts fork, before the thread has descriptors to leak. */
+	stage->argv = plan_argv(plan_get(stage->scmd), &stage->words,
+		&stage->argc);
+	if (!open_redirections(stage->scmd, fds)) {
+		expansion_free(&stage->words);
+		return false;
+	}
+
+	stage->io[STDIN_FILENO] = stage_fd(fds[STDIN_FILENO], in,
+		STDIN_FILENO);
+	stage->io[STDOUT_FILENO] = stage_fd(fds[STDOUT_FILENO], out,
+		STDOUT_FILENO);
+	stage->io[STDERR_FILENO] = stage_fd(fds[STDERR_FILENO], -1,
+		STDERR_FILENO);
+	add_running(stage);
+
+	if (pthread_create(&stage->thread, NULL, cat_stage, stage) != 0) {
+		remove_running(stage);
+		expansion_free(&stage->words);
+		return false;
+	}
+	stage->threaded = true;
 
 	return true;
 }
 
+/**
+ * Size of the pipeline pipes from MINISHELL_PIPE_SIZE, in bytes (0 keeps
+ * the default); larger pipes move more data per context switch.
+ */
+static int pipe_size(void)
+{
+	const char *value = env_getenv("MINISHELL_PIPE_SIZE");
+	long size = value ? strtol(value, NULL, 10) : 0;
+
+	return size > 0 && size <= INT_MAX ? size : 0;
+}
+
+static void stage_done(pid_t pid, int code, void *arg)
+{
+	struct stage *stage = arg;
+
+	stage->status = code;
+	stage->pipeline->running--;
+}
 
 /**
- * Run commands by creating an anonymous pipe (cmd1 | cmd2).
+ * Run a pipeline: all the pipes are created up front, all the stages are
+ * started at once and then reaped as they exit, in any order. The status
+ * is the one of the last stage or, when MINISHELL_PIPEFAIL is set, the
+ * one of the last stage that failed.
  */
-static bool run_on_pipe(command_t *cmd1, command_t *cmd2, int level,
-		command_t *father)
+static int run_on_pipe(command_t *c, int level, command_t *father)
 {
-	/* Redirect the output of cmd1 to the input of cmd2. */
+	struct pipeline p = { NULL, 0, 0, 0, NULL };
+	bool pipefail = env_getenv("MINISHELL_PIPEFAIL") != NULL;
+	int in, out, size = pipe_size(), ret = SUCCESS_CODE;
+	struct stage *stage;
+	struct plan *plan;
+	builtin_t builtin;
+	pid_t pid;
+	size_t i;
+
+	collect_stages(c, &p);
+
+	p.pipes = malloc((p.count - 1) * sizeof(*p.pipes));
+	DIE(p.pipes == NULL, "Error allocating pipeline.");
+
+	for (i = 0; i + 1 < p.count; i++)
+		if (pipe2(p.pipes[i], O_CLOEXEC) < 0) {
+			perror("pipe");
+			close_pipes(&p, i);
+			ret = FAILURE_CODE;
+			goto out;
+		} else if (size > 0) {
+			/* Above pipe-max-size it fails, the default stays. */
+			fcntl(p.pipes[i][WRITE], F_SETPIPE_SZ, size);
+		}
+
+	for (i = 0; i < p.count; i++) {
+		stage = &p.stages[i];
+		in = i > 0 ? p.pipes[i - 1][READ] : -1;
+		out = i + 1 < p.count ? p.pipes[i][WRITE] : -1;
+
+		plan = plan_get(stage->scmd);
+		if (plan->kind == PLAN_BUILTIN && builtin_is_cat(plan->builtin)) {
+			start_cat_thread(stage, in, out);
+			env_command_done();
+			continue;
+		}
+
+		builtin = find_builtin(stage->scmd);
+		if (builtin != NULL)
+			pid = start_builtin(builtin, stage->scmd, &p, in, out);
+		else
+			pid = start_external(stage->scmd, in, out);
+		env_command_done();
+
+		if (pid >= 0) {
+			reaper_watch(pid, stage_done, stage);
+			p.running++;
+		}
+	}
 
-	return true; 
+	/* Only the children hold the pipes now. */
+	close_pipes(&p, p.count - 1);
+
+	while (p.running > 0)
+		reaper_poll(true);
+
+	for (i = 0; i < p.count; i++)
+		if (p.stages[i].threaded) {
+			pthread_join(p.stages[i].thread, NULL);
+			expansion_free(&p.stages[i].words);
+		}
+
+	for (i = 0; i < p.count; i++)
+		if (pipefail ? p.stages[i].status != SUCCESS_CODE : i + 1 == p.count)
+			ret = p.stages[i].status;
+
+out:
+	free(p.pipes);
+	free(p.stages);
+
+	return ret;
 }
 
 /**
@@ -354,6 +844,10 @@ int parse_command(command_t *c, int level, command_t *father)
 	if (!c)
 		return FAILURE_CODE;
 
+	/* Finished jobs free their slots for the queued ones between lines. */
+	if (father == NULL)
+		jobs_poll();
+
 	/* Execute a simple command. */
 	if (c->op == OP_NONE)
 		return parse_simple(c->scmd, level, father);
@@ -364,7 +858,7 @@ int parse_command(command_t *c, int level, command_t *father)
 		return parse_command(c->cmd2, level + 1, c);
 
 	case OP_PARALLEL:
-		return run_in_parallel(c->cmd1, c->cmd2, level, father);
+		return run_in_parallel(c, level, father);
 
 	case OP_CONDITIONAL_NZERO:
 		if (parse_command(c->cmd1, level, c) == 0)
@@ -377,7 +871,7 @@ int parse_command(command_t *c, int level, command_t *father)
 		return parse_command(c->cmd2, level, c);
 
 	case OP_PIPE:
-		return run_on_pipe(c->cmd1, c->cmd2, level, father);
+		return run_on_pipe(c, level, father);
 
 	default:
 		return SHELL_EXIT;
@@ -386,3 +880,55 @@ int parse_command(command_t *c, int level, command_t *father)
 	return SUCCESS_CODE;
 
 }
+
+pid_t start_command(command_t *c, int out)
+{
+	pid_t pid;
+	int ret;
+
+	if (c->op == OP_NONE && find_builtin(c->scmd) == NULL)
+		return start_external(c->scmd, -1, out);
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0)
+		perror("fork");
+	if (pid != 0)
+		return pid;
+
+	if (out >= 0 && dup2(out, STDOUT_FILENO) < 0)
+		_exit(FAILURE_CODE);
+	forget_children();
+	ret = parse_command(c, 0, NULL);
+	fflush(NULL);
+	_exit(ret);
+}
+
+pid_t hold_command(command_t *c, const int go[2])
+{
+	char byte;
+	pid_t pid;
+	ssize_t n;
+	int ret;
+
+	fflush(NULL);
+	pid = fork();
+	if (pid < 0)
+		perror("fork");
+	if (pid != 0)
+		return pid;
+
+	close(go[WRITE]);
+	forget_children();
+
+	do {
+		n = read(go[READ], &byte, 1);
+	} while (n < 0 && errno == EINTR);
+	if (n != 1)
+		_exit(FAILURE_CODE);
+	close(go[READ]);
+
+	ret = parse_command(c, 0, NULL);
+	fflush(NULL);
+	_exit(ret);
+}
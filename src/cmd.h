@@ -3,6 +3,8 @@
 #ifndef _CMD_H
 #define _CMD_H
 
+#include <sys/types.h>
+
 #include "../util/parser/parser.h"
 
 #define SHELL_EXIT -100
@@ -15,4 +17,20 @@
  */
 int parse_command(command_t *cmd, int level, command_t *father);
 
+/**
+ * Start a command without waiting for it: external commands are
+ * launched directly, anything else runs in a child of the shell. Its
+ * standard output goes to out, unless out is -1 or the command redirects
+ * it. Returns the pid of the child, -1 if it could not be started.
+ */
+pid_t start_command(command_t *c, int out);
+
+/**
+ * Fork a child that runs a command later: it has the variables and the
+ * directory of the shell at this point, and runs the command once a
+ * byte can be read from go[0]; if go[1] is closed first, it exits with
+ * FAILURE_CODE. Returns the pid of the child, -1 if it could not fork.
+ */
+pid_t hold_command(command_t *c, const int go[2]);
+
 #endif /* _CMD_H */
@@ -0,0 +1,304 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "env.h"
+#include "utils.h"
+
+/* Values up to this size, with the '\0', are kept in the variable. */
+#define ENV_INLINE	32
+
+/*
+ * A variable is allocated once with its name and never moves or goes
+ * away, so the name is interned: the table and the envp order only hold
+ * pointers to it.
+ */
+struct env_var {
+	char *value;
+	size_t value_length;
+	size_t value_capacity;
+	size_t name_length;
+	uint32_t hash;
+	bool exported;
+	bool set;
+	char inline_value[ENV_INLINE];
+	char name[];
+};
+
+/*
+ * Open addressing with linear probing; the slot keeps the hash, so a
+ * probe only touches the variable when the hashes match.
+ */
+struct env_slot {
+	uint32_t hash;
+	struct env_var *var;
+};
+
+static struct {
+	struct env_slot *slots;
+	size_t mask;
+	struct env_var **order;
+	size_t count;
+	size_t capacity;
+	char **envp;
+	bool dirty;
+	unsigned long command_start;
+	struct env_stats stats;
+} env = { .dirty = true };
+
+/* FNV-1a. */
+static uint32_t env_hash(const char *name, size_t length)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < length; i++) {
+		hash ^= (unsigned char)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static struct env_slot *env_probe(const char *name, size_t length,
+		uint32_t hash)
+{
+	struct env_slot *slot;
+	size_t i;
+
+	for (i = hash & env.mask; ; i = (i + 1) & env.mask) {
+		slot = &env.slots[i];
+		if (slot->var == NULL)
+			return slot;
+		if (slot->hash == hash && slot->var->name_length == length &&
+			memcmp(slot->var->name, name, length) == 0)
+			return slot;
+	}
+}
+
+/* Keep the load under 1/2; there is no deletion, so no tombstones. */
+static void env_grow(void)
+{
+	struct env_slot *old = env.slots;
+	size_t old_size = old ? env.mask + 1 : 0, size, i;
+	struct env_var *var;
+
+	if (2 * (env.count + 1) <= old_size)
+		return;
+
+	size = old_size ? 2 * old_size : 256;
+	env.slots = calloc(size, sizeof(*env.slots));
+	DIE(env.slots == NULL, "Error allocating the environment.");
+	env.mask = size - 1;
+
+	for (i = 0; i < old_size; i++) {
+		var = old[i].var;
+		if (var != NULL)
+			*env_probe(var->name, var->name_length, var->hash) = old[i];
+	}
+	free(old);
+
+	env.capacity = size / 2;
+	env.order = realloc(env.order, env.capacity * sizeof(*env.order));
+	DIE(env.order == NULL, "Error allocating the environment.");
+}
+
+static void env_assign(struct env_var *var, const char *value,
+		size_t length)
+{
+	if (length >= var->value_capacity) {
+		if (var->value != var->inline_value)
+			free(var->value);
+		var->value_capacity = length + 1;
+		var->value = malloc(var->value_capacity);
+		DIE(var->value == NULL, "Error allocating a variable.");
+	}
+
+	memcpy(var->value, value, length);
+	var->value[length] = '\0';
+	var->value_length = length;
+	var->set = true;
+}
+
+/* Find a variable, or add it, unset, with the given export flag. */
+static struct env_var *env_intern(const char *name, size_t length,
+		bool exported)
+{
+	uint32_t hash = env_hash(name, length);
+	struct env_slot *slot = env_probe(name, length, hash);
+	struct env_var *var;
+
+	if (slot->var != NULL)
+		return slot->var;
+
+	env_grow();
+	slot = env_probe(name, length, hash);
+
+	var = malloc(sizeof(*var) + length + 1);
+	DIE(var == NULL, "Error allocating a variable.");
+	var->value = var->inline_value;
+	var->value_length = 0;
+	var->value_capacity = ENV_INLINE;
+	var->inline_value[0] = '\0';
+	var->name_length = length;
+	var->hash = hash;
+	var->exported = exported;
+	var->set = false;
+	memcpy(var->name, name, length);
+	var->name[length] = '\0';
+
+	slot->hash = hash;
+	slot->var = var;
+	env.order[env.count++] = var;
+	env.stats.variables = env.count;
+
+	return var;
+}
+
+static bool env_valid_name(const char *name, size_t length)
+{
+	return length != 0 && memchr(name, '=', length) == NULL;
+}
+
+void env_init(void)
+{
+	extern char **environ;
+	struct env_var *var;
+	char **entry, *equal;
+
+	env_grow();
+
+	for (entry = environ; *entry != NULL; entry++) {
+		equal = strchr(*entry, '=');
+		if (equal == NULL || equal == *entry)
+			continue;
+
+		var = env_intern(*entry, equal - *entry, true);
+		env_assign(var, equal + 1, strlen(equal + 1));
+	}
+}
+
+const char *env_get(const char *name, size_t length, size_t *value_length)
+{
+	struct env_var *var;
+
+	env.stats.lookups++;
+
+	var = env_probe(name, length, env_hash(name, length))->var;
+	if (var == NULL || !var->set)
+		return NULL;
+
+	if (value_length != NULL)
+		*value_length = var->value_length;
+	return var->value;
+}
+
+const char *env_getenv(const char *name)
+{
+	return env_get(name, strlen(name), NULL);
+}
+
+int env_set(const char *name, const char *value)
+{
+	size_t length = strlen(name);
+	struct env_var *var;
+
+	if (!env_valid_name(name, length))
+		return -1;
+
+	/*
+	 * A new variable is exported, as setenv did before the shell had
+	 * its own store; export -n takes it out of the environment.
+	 */
+	var = env_intern(name, length, true);
+	env_assign(var, value, strlen(value));
+	if (var->exported)
+		env.dirty = true;
+	env.stats.assignments++;
+
+	return 0;
+}
+
+int env_export(const char *name, bool exported)
+{
+	size_t length = strlen(name);
+	struct env_var *var;
+
+	if (!env_valid_name(name, length))
+		return -1;
+
+	var = env_intern(name, length, exported);
+	if (var->exported != exported) {
+		var->exported = exported;
+		env.dirty |= var->set;
+	}
+
+	return 0;
+}
+
+/**
+ * Pack the pointers and the "NAME=value" entries of the exported
+ * variables in one block, in the order they were first set.
+ */
+static void env_rebuild(void)
+{
+	size_t size = sizeof(char *), entries = 0, i;
+	struct env_var *var;
+	char *strings;
+
+	for (i = 0; i < env.count; i++)
+		if (env.order[i]->exported && env.order[i]->set) {
+			size += sizeof(char *) + env.order[i]->name_length +
+				env.order[i]->value_length + 2;
+			entries++;
+		}
+
+	free(env.envp);
+	env.envp = malloc(size);
+	DIE(env.envp == NULL, "Error allocating envp.");
+
+	strings = (char *)(env.envp + entries + 1);
+	entries = 0;
+	for (i = 0; i < env.count; i++) {
+		var = env.order[i];
+		if (!var->exported || !var->set)
+			continue;
+
+		env.envp[entries++] = strings;
+		memcpy(strings, var->name, var->name_length);
+		strings += var->name_length;
+		*strings++ = '=';
+		memcpy(strings, var->value, var->value_length + 1);
+		strings += var->value_length + 1;
+	}
+	env.envp[entries] = NULL;
+
+	env.dirty = false;
+	env.stats.rebuilds++;
+}
+
+char **env_envp(void)
+{
+	if (env.dirty)
+		env_rebuild();
+
+	return env.envp;
+}
+
+void env_command_done(void)
+{
+	unsigned long lookups = env.stats.lookups - env.command_start;
+
+	env.stats.commands++;
+	if (lookups > env.stats.max_command_lookups)
+		env.stats.max_command_lookups = lookups;
+	env.command_start = env.stats.lookups;
+}
+
+const struct env_stats *env_get_stats(void)
+{
+	return &env.stats;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ENV_H
+#define _ENV_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Variable store: the shell keeps its variables in an open addressing
+ * hash table instead of in the libc environ (getenv scans it, setenv may
+ * copy all of it), so a lookup does not depend on the number of
+ * variables. Short values are kept in the variable itself. The exported
+ * ones make up the envp array given to the commands, packed in one block
+ * and only rebuilt, before a command starts, when one of them changed.
+ */
+
+struct env_stats {
+	unsigned long lookups;
+	unsigned long assignments;
+	unsigned long rebuilds;
+	unsigned long commands;
+	unsigned long max_command_lookups;
+	size_t variables;
+};
+
+/**
+ * Load the environment the shell was started with, as exported
+ * variables. Called before any other function of the store.
+ */
+void env_init(void);
+
+/**
+ * Get the value of a variable whose name is a slice (not null
+ * terminated), and its length in *value_length if value_length is not
+ * NULL; NULL if it is not set. The value is valid until the variable
+ * changes.
+ */
+const char *env_get(const char *name, size_t length, size_t *value_length);
+
+/**
+ * env_get for a null terminated name.
+ */
+const char *env_getenv(const char *name);
+
+/**
+ * Set a variable; -1 if the name is not valid (empty or holding '=').
+ * A new variable is exported.
+ */
+int env_set(const char *name, const char *value);
+
+/**
+ * Add a variable to the environment of the commands, or take it out
+ * (export -n); -1 if the name is not valid.
+ */
+int env_export(const char *name, bool exported);
+
+/**
+ * The environment of the commands (the exported variables that are
+ * set), NULL terminated.
+ */
+char **env_envp(void);
+
+/**
+ * Count a command, for the lookups per command in the stats.
+ */
+void env_command_done(void);
+
+const struct env_stats *env_get_stats(void);
+
+#endif /* _ENV_H */
@@ -0,0 +1,111 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "env.h"
+#include "expand.h"
+#include "subst.h"
+#include "utils.h"
+
+#define EXPANSION_MIN	256
+
+void expansion_reserve(struct expansion *e, size_t size)
+{
+	size_t capacity = e->capacity ? e->capacity : EXPANSION_MIN;
+
+	if (e->length + size <= e->capacity)
+		return;
+
+	while (capacity < e->length + size)
+		capacity *= 2;
+
+	e->data = realloc(e->data, capacity);
+	DIE(e->data == NULL, "Error allocating the expansion buffer.");
+	e->capacity = capacity;
+}
+
+static void expansion_append(struct expansion *e, const char *string,
+		size_t length)
+{
+	expansion_reserve(e, length);
+	memcpy(e->data + e->length, string, length);
+	e->length += length;
+}
+
+size_t expand_word(struct expansion *e, word_t *word, size_t *length)
+{
+	size_t start = e->length, part_length;
+	const char *part;
+
+	for (; word != NULL; word = word->next_part) {
+		/* The output of the command goes right into the buffer. */
+		if (word->command != NULL) {
+			substitute(e, word->command);
+			continue;
+		}
+
+		if (word->expand) {
+			/* Unset variables expand to "". */
+			part = env_get(word->string, word->length, &part_length);
+			if (part == NULL)
+				part_length = 0;
+		} else {
+			part = word->string;
+			part_length = word->length;
+		}
+
+		expansion_append(e, part, part_length);
+	}
+
+	expansion_append(e, "", 1);
+	if (length != NULL)
+		*length = e->length - start - 1;
+
+	return start;
+}
+
+char **expand_argv(struct expansion *e, word_t *const words[],
+		char *const literals[], size_t count)
+{
+	size_t head, offset, i;
+	char **argv;
+
+	/*
+	 * The pointers go first, aligned, and hold the offsets of the
+	 * expanded words until they are all written: the buffer may move
+	 * meanwhile.
+	 */
+	head = (e->length + sizeof(char *) - 1) & ~(sizeof(char *) - 1);
+	expansion_reserve(e, head - e->length + (count + 1) * sizeof(char *));
+	e->length = head + (count + 1) * sizeof(char *);
+
+	for (i = 0; i < count; i++) {
+		if (literals[i] != NULL)
+			continue;
+		offset = expand_word(e, words[i], NULL);
+		memcpy(e->data + head + i * sizeof(char *), &offset,
+			sizeof(offset));
+	}
+
+	argv = (char **)(e->data + head);
+	for (i = 0; i < count; i++) {
+		if (literals[i] != NULL) {
+			argv[i] = literals[i];
+			continue;
+		}
+		memcpy(&offset, &argv[i], sizeof(offset));
+		argv[i] = e->data + offset;
+	}
+	argv[count] = NULL;
+
+	return argv;
+}
+
+void expansion_free(struct expansion *e)
+{
+	free(e->data);
+	e->data = NULL;
+	e->length = e->capacity = 0;
+}
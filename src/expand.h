@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _EXPAND_H
+#define _EXPAND_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Word expansion: the parts of a word (literals, $VARs and the output of
+ * $(...) commands) are resolved once each and written one after the
+ * other in the scratch buffer of the command, which only grows by
+ * doubling. A word is its offset in the buffer and its length; it is
+ * also null terminated.
+ */
+struct expansion {
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+#define EXPANSION_INIT	{ NULL, 0, 0 }
+
+/**
+ * Make room for size more bytes at the end of the buffer.
+ */
+void expansion_reserve(struct expansion *e, size_t size);
+
+/**
+ * Expand a word (NULL expands to "") at the end of the buffer. Returns
+ * its offset, its length is stored in *length if length is not NULL.
+ */
+size_t expand_word(struct expansion *e, word_t *word, size_t *length);
+
+/**
+ * The word at offset; the pointer is valid until the next word is added.
+ */
+static inline char *expansion_at(struct expansion *e, size_t offset)
+{
+	return e->data + offset;
+}
+
+/**
+ * Build a NULL terminated argv of count words for execv, in the buffer
+ * with the words: literals[i] is used as it is when it is not NULL, else
+ * words[i] is expanded. The buffer must not grow while argv is used.
+ */
+char **expand_argv(struct expansion *e, word_t *const words[],
+		char *const literals[], size_t count);
+
+/**
+ * Drop the words, keeping the buffer for the next ones.
+ */
+static inline void expansion_reset(struct expansion *e)
+{
+	e->length = 0;
+}
+
+void expansion_free(struct expansion *e);
+
+#endif /* _EXPAND_H */
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "fd_cache.h"
+#include "utils.h"
+
+/*
+ * The cache holds a few descriptors, entries are found with a scan of
+ * the hashes; used is the tick of the last use, for the LRU.
+ */
+struct fd_entry {
+	char *path;
+	uint64_t hash;
+	int flags;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	unsigned long used;
+};
+
+static struct {
+	struct fd_entry *entries;
+	size_t limit;
+	unsigned long tick;
+	bool initialized;
+	struct fd_cache_stats stats;
+} cache;
+
+/**
+ * FNV-1a hash of the file name.
+ */
+static uint64_t hash_path(const char *path)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *path != '\0'; path++) {
+		hash ^= (unsigned char)*path;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static void cache_init(void)
+{
+	const char *limit = env_getenv("MINISHELL_FD_CACHE");
+
+	cache.limit = limit ? strtoull(limit, NULL, 10) : 0;
+	if (cache.limit > 0) {
+		cache.entries = calloc(cache.limit, sizeof(*cache.entries));
+		DIE(cache.entries == NULL, "Error allocating the fd cache.");
+	}
+	cache.initialized = true;
+}
+
+static struct fd_entry *cache_find(const char *path, uint64_t hash,
+		int flags)
+{
+	size_t i;
+
+	for (i = 0; i < cache.stats.entries; i++)
+		if (cache.entries[i].hash == hash &&
+			cache.entries[i].flags == flags &&
+			strcmp(cache.entries[i].path, path) == 0)
+			return &cache.entries[i];
+
+	return NULL;
+}
+
+/* The last entry takes the place of the one removed. */
+static void cache_remove(struct fd_entry *entry)
+{
+	close(entry->fd);
+	free(entry->path);
+	*entry = cache.entries[--cache.stats.entries];
+}
+
+static void cache_evict(void)
+{
+	struct fd_entry *oldest = &cache.entries[0];
+	size_t i;
+
+	for (i = 1; i < cache.stats.entries; i++)
+		if (cache.entries[i].used < oldest->used)
+			oldest = &cache.entries[i];
+
+	cache_remove(oldest);
+	cache.stats.evictions++;
+}
+
+static void cache_insert(const char *path, uint64_t hash, int flags, int fd,
+		const struct stat *st)
+{
+	struct fd_entry *entry;
+	char *copy = strdup(path);
+
+	DIE(copy == NULL, "Error allocating the fd cache.");
+	if (cache.stats.entries == cache.limit)
+		cache_evict();
+
+	entry = &cache.entries[cache.stats.entries++];
+	entry->path = copy;
+	entry->hash = hash;
+	entry->flags = flags;
+	entry->fd = fd;
+	entry->dev = st->st_dev;
+	entry->ino = st->st_ino;
+	entry->used = ++cache.tick;
+}
+
+int fd_cache_open(const char *path, int flags)
+{
+	struct fd_entry *entry;
+	struct stat st;
+	uint64_t hash;
+	int fd, copy;
+
+	if (!cache.initialized)
+		cache_init();
+
+	if (cache.limit == 0 || !(flags & O_APPEND))
+		return open(path, flags | O_CLOEXEC, 0644);
+
+	hash = hash_path(path);
+	entry = cache_find(path, hash, flags);
+	if (entry != NULL) {
+		/* The name must still lead to the file that is open. */
+		if (stat(path, &st) == 0 && st.st_dev == entry->dev &&
+			st.st_ino == entry->ino) {
+			cache.stats.hits++;
+			entry->used = ++cache.tick;
+			return fcntl(entry->fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+		}
+
+		cache_remove(entry);
+		cache.stats.invalidations++;
+	}
+
+	cache.stats.misses++;
+	fd = open(path, flags | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return fd;
+
+	/* FIFOs and devices are opened every time, as without the cache. */
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+		return fd;
+
+	copy = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1);
+	if (copy < 0)
+		return fd;
+
+	cache_insert(path, hash, flags, fd, &st);
+	return copy;
+}
+
+void fd_cache_forget(void)
+{
+	while (cache.stats.entries > 0)
+		cache_remove(&cache.entries[0]);
+}
+
+const struct fd_cache_stats *fd_cache_get_stats(void)
+{
+	return &cache.stats;
+}
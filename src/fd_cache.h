@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _FD_CACHE_H
+#define _FD_CACHE_H
+
+#include <stddef.h>
+
+/*
+ * Cache of the files opened for >> and 2>>: with MINISHELL_FD_CACHE set
+ * to a number of descriptors, the regular files opened with O_APPEND are
+ * kept open, keyed by name and flags, and the next redirection to the
+ * same file gets a copy of the descriptor instead of opening it again.
+ * An entry is dropped when the name no longer leads to the same inode
+ * (the log was rotated, or the directory changed), and the least recently
+ * used one when the cache is full.
+ */
+
+struct fd_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long invalidations;
+	unsigned long evictions;
+	size_t entries;
+};
+
+/**
+ * open(path, flags | O_CLOEXEC, 0644) through the cache. The descriptor
+ * belongs to the caller, who closes it. -1, with errno set, on errors.
+ */
+int fd_cache_open(const char *path, int flags);
+
+/**
+ * Close the cached descriptors; done by the forked children.
+ */
+void fd_cache_forget(void);
+
+const struct fd_cache_stats *fd_cache_get_stats(void);
+
+#endif /* _FD_CACHE_H */
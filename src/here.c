@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/* memfd_create, pipe2 */
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "here.h"
+
+struct here_writer {
+	struct expansion text;
+	size_t offset;
+	size_t length;
+	int fd;
+};
+
+static bool write_all(int fd, const char *data, size_t length)
+{
+	ssize_t n;
+
+	while (length > 0) {
+		n = write(fd, data, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+
+	return true;
+}
+
+/**
+ * Writer thread of a pipe: SIGPIPE is blocked, so a command that does not
+ * read all of its input ends the copy instead of the shell.
+ */
+static void *here_write(void *arg)
+{
+	struct here_writer *w = arg;
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+	write_all(w->fd, expansion_at(&w->text, w->offset), w->length);
+	close(w->fd);
+	expansion_free(&w->text);
+	free(w);
+
+	return NULL;
+}
+
+static int here_pipe(struct expansion *e, size_t offset, size_t length)
+{
+	struct here_writer *w;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int fds[2], ret;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("here-document");
+		return -1;
+	}
+
+	w = malloc(sizeof(*w));
+	if (w == NULL) {
+		perror("here-document");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	/* The writer owns the text until it is done. */
+	w->text = *e;
+	w->offset = offset;
+	w->length = length;
+	w->fd = fds[1];
+	*e = (struct expansion)EXPANSION_INIT;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thread, &attr, here_write, w);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		errno = ret;
+		perror("here-document");
+		*e = w->text;
+		free(w);
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+
+	return fds[0];
+}
+
+int here_open(struct expansion *e, size_t offset, size_t length)
+{
+	int fd;
+
+	if (length > HERE_PIPE_SIZE)
+		return here_pipe(e, offset, length);
+
+	fd = memfd_create("here-document", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return here_pipe(e, offset, length);
+
+	/* Sealed, the text stays what it was for every reader. */
+	if (!write_all(fd, expansion_at(e, offset), length) ||
+		fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW |
+			F_SEAL_WRITE | F_SEAL_SEAL) < 0 ||
+		lseek(fd, 0, SEEK_SET) < 0) {
+		perror("here-document");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _HERE_H
+#define _HERE_H
+
+#include <stddef.h>
+
+#include "expand.h"
+
+/*
+ * The standard input of the here-documents and here-strings: the text is
+ * written to a sealed memfd, which the command reads like a file, with no
+ * name in any file system. A text larger than HERE_PIPE_SIZE is fed to a
+ * pipe by a thread instead, so it is never held twice in memory.
+ */
+
+#define HERE_PIPE_SIZE	(16 << 20)
+
+/**
+ * Get a descriptor for reading the length bytes at offset in e. The pipe
+ * writer takes the buffer of e, which is left empty. -1, with an error
+ * printed, if it cannot be done.
+ */
+int here_open(struct expansion *e, size_t offset, size_t length);
+
+#endif /* _HERE_H */
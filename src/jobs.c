@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "env.h"
+#include "jobs.h"
+#include "reaper.h"
+#include "utils.h"
+
+/*
+ * A queued job is a child forked when the job was submitted, so that it
+ * sees the variables and the directory of the shell at that point; it
+ * waits for a byte on its go socket to run. A socket, so that the byte
+ * for a child that died meanwhile gives an error rather than SIGPIPE.
+ */
+struct job {
+	struct job *next;
+	int go;
+	bool started;
+};
+
+static struct {
+	size_t count;
+	struct job *head;
+	struct job *tail;
+	size_t queued;
+	struct job_stats stats;
+} jobs;
+
+/**
+ * Number of slots, read on every use so MINISHELL_JOBS can be assigned
+ * by the script itself.
+ */
+static size_t job_limit(void)
+{
+	const char *value = env_getenv("MINISHELL_JOBS");
+	long limit = value ? strtol(value, NULL, 10) : 0;
+
+	if (limit <= 0)
+		limit = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return limit > 0 ? limit : 1;
+}
+
+static void start_queued(void);
+
+static void unlink_job(struct job *job)
+{
+	struct job **link, *prev = NULL;
+
+	for (link = &jobs.head; *link != job; link = &(*link)->next)
+		prev = *link;
+	*link = job->next;
+	if (jobs.tail == job)
+		jobs.tail = prev;
+	jobs.queued--;
+}
+
+/**
+ * A finished job frees its slot for the first queued one right away,
+ * even while the shell waits for something else. A queued job that ends
+ * before it was started (killed) only leaves the queue.
+ */
+static void job_done(pid_t pid, int code, void *arg)
+{
+	struct job *job = arg;
+
+	if (job != NULL && !job->started) {
+		unlink_job(job);
+		close(job->go);
+		free(job);
+		return;
+	}
+
+	free(job);
+	jobs.count--;
+	start_queued();
+}
+
+static void job_started(pid_t pid)
+{
+	if (pid < 0)
+		return;
+
+	reaper_watch(pid, job_done, NULL);
+	jobs.count++;
+	jobs.stats.started++;
+}
+
+static void start_queued(void)
+{
+	size_t limit = job_limit();
+	struct job *job;
+
+	while (jobs.head != NULL && jobs.count < limit) {
+		job = jobs.head;
+		unlink_job(job);
+
+		/* A child that died is reaped as a started job. */
+		send(job->go, "", 1, MSG_NOSIGNAL);
+		close(job->go);
+		job->started = true;
+		jobs.count++;
+		jobs.stats.started++;
+	}
+}
+
+void jobs_poll(void)
+{
+	reaper_poll(false);
+	start_queued();
+}
+
+void jobs_submit(command_t *c)
+{
+	struct job *job;
+	int go[2];
+	pid_t pid;
+
+	jobs_poll();
+	if (jobs.count < job_limit()) {
+		job_started(start_command(c, -1));
+		return;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, go) < 0) {
+		perror("socketpair");
+		return;
+	}
+
+	pid = hold_command(c, go);
+	close(go[0]);
+	if (pid < 0) {
+		close(go[1]);
+		return;
+	}
+
+	job = malloc(sizeof(*job));
+	DIE(job == NULL, "Error allocating job.");
+	job->next = NULL;
+	job->go = go[1];
+	job->started = false;
+	reaper_watch(pid, job_done, job);
+
+	if (jobs.tail != NULL)
+		jobs.tail->next = job;
+	else
+		jobs.head = job;
+	jobs.tail = job;
+
+	jobs.stats.queued++;
+	if (++jobs.queued > jobs.stats.max_queued)
+		jobs.stats.max_queued = jobs.queued;
+}
+
+void jobs_wait(void)
+{
+	jobs_poll();
+
+	while (jobs.count > 0 || jobs.head != NULL) {
+		reaper_poll(true);
+		start_queued();
+	}
+}
+
+void jobs_forget(void)
+{
+	struct job *job;
+
+	/* Closing the go sockets lets a queued job see the shell is gone. */
+	while (jobs.head != NULL) {
+		job = jobs.head;
+		jobs.head = job->next;
+		close(job->go);
+		free(job);
+	}
+
+	jobs.tail = NULL;
+	jobs.queued = 0;
+	jobs.count = 0;
+}
+
+const struct job_stats *jobs_get_stats(void)
+{
+	return &jobs.stats;
+}
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _JOBS_H
+#define _JOBS_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Background jobs (the commands before a &) run in job slots: at most
+ * MINISHELL_JOBS of them (default: the number of online CPUs) run at
+ * once, the others wait in a FIFO queue and start as slots free up.
+ */
+
+struct job_stats {
+	unsigned long started;
+	unsigned long queued;
+	size_t max_queued;
+};
+
+/**
+ * Run a command as a background job, now if a slot is free, later
+ * otherwise; a queued job is forked now and only waits for its slot, so
+ * it runs with the variables and the directory of this point.
+ */
+void jobs_submit(command_t *c);
+
+/**
+ * Reap the jobs that finished and start queued jobs in the free slots,
+ * without blocking.
+ */
+void jobs_poll(void);
+
+/**
+ * Wait until every job, queued ones included, has finished (wait).
+ */
+void jobs_wait(void);
+
+/**
+ * Drop the jobs of the shell, in its children: they are not theirs to
+ * wait for or to start.
+ */
+void jobs_forget(void);
+
+const struct job_stats *jobs_get_stats(void);
+
+#endif /* _JOBS_H */
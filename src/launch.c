@@ -0,0 +1,200 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "env.h"
+#include "launch.h"
+#include "zygote.h"
+
+enum launch_method launch_method = LAUNCH_SPAWN;
+
+void launch_init(void)
+{
+	static bool initialized;
+	const char *method;
+
+	if (initialized)
+		return;
+
+	method = env_getenv("MINISHELL_LAUNCH");
+	if (method != NULL && strcmp(method, "fork") == 0)
+		launch_method = LAUNCH_FORK;
+	if (method != NULL && strcmp(method, "zygote") == 0 && zygote_start())
+		launch_method = LAUNCH_ZYGOTE;
+	initialized = true;
+}
+
+/**
+ * Arguments of /bin/sh running path as a script: sh path argv[1]...,
+ * in script, which has room for the arguments of argv and two more.
+ */
+static void script_argv(const char *path, char *const argv[],
+		char **script)
+{
+	size_t i;
+
+	script[0] = (char *)LAUNCH_SHELL;
+	script[1] = (char *)path;
+	for (i = 1; argv[0] != NULL && argv[i] != NULL; i++)
+		script[i + 1] = argv[i];
+	script[i + 1] = NULL;
+}
+
+static size_t count_args(char *const argv[])
+{
+	size_t argc = 0;
+
+	while (argv[argc] != NULL)
+		argc++;
+
+	return argc;
+}
+
+static void exec_script(const char *path, char *const argv[],
+		char *const envp[])
+{
+	char *script[count_args(argv) + 2];
+
+	script_argv(path, argv, script);
+	execve(LAUNCH_SHELL, script, envp);
+}
+
+void launch_exec(const char *path, char *const argv[], char *const envp[])
+{
+	execve(path, argv, envp);
+	if (errno == ENOEXEC)
+		exec_script(path, argv, envp);
+}
+
+static pid_t launch_fork(const char *path, char *const argv[],
+		char *const envp[], const int fds[3])
+{
+	pid_t pid = fork();
+	sigset_t mask;
+	int i;
+
+	if (pid != 0)
+		return pid;
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	for (i = 0; i < 3; i++) {
+		if (fds[i] == i && fcntl(i, F_SETFD, 0) < 0)
+			_exit(FAILURE_CODE);
+		if (fds[i] >= 0 && fds[i] != i && dup2(fds[i], i) < 0)
+			_exit(FAILURE_CODE);
+	}
+
+	launch_exec(path, argv, envp);
+	_exit(FAILURE_CODE);
+}
+
+/**
+ * glibc's posix_spawn reports ENOEXEC instead of running the file with
+ * /bin/sh as execvp does; the fallback is done here.
+ */
+static int spawn_script(pid_t *pid, const char *path,
+		const posix_spawn_file_actions_t *actions,
+		const posix_spawnattr_t *attr, char *const argv[],
+		char *const envp[])
+{
+	char *script[count_args(argv) + 2];
+
+	script_argv(path, argv, script);
+
+	return posix_spawn(pid, LAUNCH_SHELL, actions, attr, script, envp);
+}
+
+/**
+ * The redirections become dup2 file actions; the files themselves were
+ * opened by the shell, so nothing but the exec can fail in the child.
+ * Commands start with no signal blocked, whatever the shell blocks (the
+ * reaper may block SIGCHLD).
+ */
+static pid_t launch_spawn(const char *path, char *const argv[],
+		char *const envp[], const int fds[3])
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_t *pactions = NULL;
+	posix_spawnattr_t attr;
+	sigset_t mask;
+	pid_t pid;
+	int err = 0;
+	int i;
+
+	for (i = 0; i < 3 && err == 0; i++) {
+		if (fds[i] < 0)
+			continue;
+
+		if (pactions == NULL) {
+			err = posix_spawn_file_actions_init(&actions);
+			if (err != 0)
+				break;
+			pactions = &actions;
+		}
+		err = posix_spawn_file_actions_adddup2(pactions, fds[i], i);
+	}
+
+	if (err == 0)
+		err = posix_spawnattr_init(&attr);
+	if (err == 0) {
+		sigemptyset(&mask);
+		err = posix_spawnattr_setsigmask(&attr, &mask);
+		if (err == 0)
+			err = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+		if (err == 0)
+			err = posix_spawn(&pid, path, pactions, &attr, argv, envp);
+		if (err == ENOEXEC)
+			err = spawn_script(&pid, path, pactions, &attr, argv,
+				envp);
+		posix_spawnattr_destroy(&attr);
+	}
+
+	if (pactions != NULL)
+		posix_spawn_file_actions_destroy(pactions);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	return pid;
+}
+
+pid_t launch_command(const char *path, char *const argv[],
+		char *const envp[], const int fds[3])
+{
+	pid_t pid;
+	int i;
+
+	launch_init();
+
+	if (launch_method == LAUNCH_FORK)
+		return launch_fork(path, argv, envp, fds);
+
+	/* Without the zygote (in the shell's children, or if it died) spawn. */
+	if (launch_method == LAUNCH_ZYGOTE && zygote_usable()) {
+		pid = zygote_launch(path, argv, envp, fds);
+		if (pid >= 0 || zygote_usable())
+			return pid;
+	}
+
+	/*
+	 * A redirection opened right in its standard slot (the shell had it
+	 * closed) only needs close-on-exec cleared, which not every
+	 * posix_spawn does for a dup2 onto itself.
+	 */
+	for (i = 0; i < 3; i++)
+		if (fds[i] == i)
+			return launch_fork(path, argv, envp, fds);
+
+	return launch_spawn(path, argv, envp, fds);
+}
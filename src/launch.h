@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _LAUNCH_H
+#define _LAUNCH_H
+
+#include <sys/types.h>
+
+/*
+ * How external commands are started: posix_spawn (glibc runs the child
+ * with clone(CLONE_VM | CLONE_VFORK), the page tables of the shell are
+ * never copied), fork, kept as a fallback and for comparison, or the
+ * zygote (see zygote.h). MINISHELL_LAUNCH=fork or MINISHELL_LAUNCH=zygote
+ * selects them.
+ */
+enum launch_method {
+	LAUNCH_SPAWN,
+	LAUNCH_FORK,
+	LAUNCH_ZYGOTE
+};
+
+extern enum launch_method launch_method;
+
+/* Runs the executable files that have no known format, like execvp. */
+#define LAUNCH_SHELL	"/bin/sh"
+
+/**
+ * Pick the method; the zygote is forked here, so this is done when the
+ * shell starts, while it is small.
+ */
+void launch_init(void);
+
+/**
+ * Run the file at path with the arguments in argv and the environment
+ * in envp, with fds[0], fds[1] and fds[2] as its standard input, output
+ * and error (-1 keeps the shell's); the shell's other descriptors must
+ * be close-on-exec. Returns the pid of the child, or -1 with errno set;
+ * with posix_spawn a command that cannot be executed is reported here,
+ * with fork the child exits with FAILURE_CODE instead.
+ */
+pid_t launch_command(const char *path, char *const argv[],
+		char *const envp[], const int fds[3]);
+
+/**
+ * execve with the fallback of execvp: a file the kernel cannot execute
+ * (ENOEXEC, e.g. a script without #!) is run by LAUNCH_SHELL. Returns
+ * only if that failed, with errno set.
+ */
+void launch_exec(const char *path, char *const argv[], char *const envp[]);
+
+#endif /* _LAUNCH_H */
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "line_reader.h"
+#include "utils.h"
+
+void line_reader_init(struct line_reader *reader, int fd)
+{
+	memset(reader, 0, sizeof(*reader));
+	reader->fd = fd;
+}
+
+void line_reader_destroy(struct line_reader *reader)
+{
+	free(reader->buf);
+	memset(reader, 0, sizeof(*reader));
+}
+
+/**
+ * Cut the line ending at buf[end] (a '\n' or the end of the data).
+ */
+static char *take_line(struct line_reader *reader, size_t end, size_t *length)
+{
+	char *line = reader->buf + reader->start;
+
+	*length = end - reader->start;
+	reader->start = reader->scanned = end < reader->end ? end + 1 : end;
+
+	/* Windows */
+	if (*length > 0 && line[*length - 1] == '\r')
+		(*length)--;
+	line[*length] = '\0';
+
+	return line;
+}
+
+/**
+ * Make room for at least LINE_READER_BLOCK more bytes: the unread data
+ * is moved to the start of the buffer, which doubles if still too small.
+ */
+static void make_room(struct line_reader *reader)
+{
+	size_t capacity;
+
+	if (reader->start > 0) {
+		memmove(reader->buf, reader->buf + reader->start,
+			reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->scanned -= reader->start;
+		reader->start = 0;
+	}
+
+	if (reader->capacity - reader->end >= LINE_READER_BLOCK)
+		return;
+
+	capacity = reader->capacity ? reader->capacity * 2 : LINE_READER_BLOCK;
+	while (capacity - reader->end < LINE_READER_BLOCK)
+		capacity *= 2;
+
+	/* One more byte for the terminator of a last line without '\n'. */
+	reader->buf = realloc(reader->buf, capacity + 1);
+	DIE(reader->buf == NULL, "Error allocating command line");
+	reader->capacity = capacity;
+}
+
+char *line_reader_next(struct line_reader *reader, size_t *length)
+{
+	char *newline;
+	ssize_t n;
+
+	for (;;) {
+		newline = NULL;
+		if (reader->end > reader->scanned)
+			newline = memchr(reader->buf + reader->scanned, '\n',
+				reader->end - reader->scanned);
+		if (newline != NULL)
+			return take_line(reader, newline - reader->buf, length);
+		reader->scanned = reader->end;
+
+		if (reader->eof) {
+			if (reader->start == reader->end)
+				return NULL;
+			return take_line(reader, reader->end, length);
+		}
+
+		make_room(reader);
+
+		n = read(reader->fd, reader->buf + reader->end,
+			reader->capacity - reader->end);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			reader->eof = 1;
+		else
+			reader->end += n;
+	}
+}
@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _LINE_READER_H
+#define _LINE_READER_H
+
+#include <stddef.h>
+
+/* Initial size of the buffer and smallest read done on the descriptor. */
+#define LINE_READER_BLOCK	(64 * 1024)
+
+/*
+ * Reads lines from a file descriptor into a single buffer that is kept
+ * between lines and grows geometrically when a line does not fit.
+ */
+struct line_reader {
+	int fd;
+	char *buf;
+	size_t capacity;
+	/* Unread data is buf[start, end); buf[start, scanned) has no '\n'. */
+	size_t start;
+	size_t scanned;
+	size_t end;
+	int eof;
+};
+
+void line_reader_init(struct line_reader *reader, int fd);
+void line_reader_destroy(struct line_reader *reader);
+
+/**
+ * Get the next line, without its "\n" or "\r\n" and null terminated.
+ * The line is valid until the next call; NULL at end of file.
+ */
+char *line_reader_next(struct line_reader *reader, size_t *length);
+
+#endif /* _LINE_READER_H */
@@ -3,93 +3,132 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "../util/parser/parser.h"
+#include "ast_cache.h"
 #include "cmd.h"
+#include "env.h"
+#include "fd_cache.h"
+#include "jobs.h"
+#include "launch.h"
+#include "line_reader.h"
+#include "path_cache.h"
+#include "reaper.h"
+#include "script.h"
+#include "subst.h"
 #include "utils.h"
 
 #define PROMPT             "> "
-#define CHUNK_SIZE         1024
 
 
 void parse_error(const char *str, const int where)
 {
-	fprintf(stderr, "Parse error near %d: %s\n", where, str);
-}
-
-/**
- * Readline from mini-shell.
- */
-static char *read_line(void)
-{
-	char *line = NULL;
-	int line_length = 0;
-
-	char chunk[CHUNK_SIZE];
-	int chunk_length;
-
-	char *rc;
-
-	int endline = 0;
-
-	while (!endline) {
-		rc = fgets(chunk, CHUNK_SIZE, stdin);
-		if (rc == NULL)
-			break;
-
-		chunk_length = strlen(chunk);
-		if (chunk[chunk_length - 1] == '\n') {
-			if (chunk_length > 1 && chunk[chunk_length - 2] == '\r')
-				/* Windows */
-				chunk[chunk_length - 2] = 0;
-			else
-				chunk[chunk_length - 1] = 0;
-			endline = 1;
-		}
-
-		line = realloc(line, line_length + CHUNK_SIZE);
-		DIE(line == NULL, "Error allocating command line");
-
-		line[line_length] = '\0';
-		strcat(line, chunk);
-
-		line_length += CHUNK_SIZE;
+	if (deferred_parse_error != NULL) {
+		snprintf(deferred_parse_error, PARSE_ERROR_SIZE,
+			"Parse error near %d: %s\n", where, str);
+		return;
 	}
 
-	return line;
+	fprintf(stderr, "Parse error near %d: %s\n", where, str);
 }
 
 static void start_shell(void)
 {
+	struct line_reader input;
 	char *line;
+	size_t length;
 	command_t *root;
 
 	int ret;
 
+	/* A single buffer holds the input lines, it only grows. */
+	line_reader_init(&input, STDIN_FILENO);
+
 	for (;;) {
 		printf(PROMPT);
 		fflush(stdout);
 		ret = 0;
 
 		root = NULL;
-		line = read_line();
+		line = line_reader_next(&input, &length);
 		if (line == NULL)
-			return;
-		parse_line(line, &root);
+			break;
+
+		/* Repeated lines reuse their tree and skip the parser. */
+		ast_cache_parse(line, length, &root);
+
+		/* The lines after a here-document are its body. */
+		while (ast_cache_heredoc_pending()) {
+			line = line_reader_next(&input, &length);
+			if (line == NULL || !ast_cache_heredoc_line(line, length))
+				break;
+		}
 
 		if (root != NULL)
 			ret = parse_command(root, 0, NULL);
 
-		free_parse_memory();
-		free(line);
-
 		if (ret == SHELL_EXIT)
 			break;
 	}
+
+	line_reader_destroy(&input);
 }
 
-int main(void)
+/**
+ * Print the shell counters on exit when MINISHELL_STATS is set.
+ */
+static void print_stats(void)
 {
+	const struct ast_cache_stats *cache = ast_cache_get_stats();
+	const struct path_cache_stats *paths = path_cache_get_stats();
+	const struct job_stats *jobs = jobs_get_stats();
+	const struct env_stats *env = env_get_stats();
+	const struct fd_cache_stats *fds = fd_cache_get_stats();
+	const struct subst_stats *subst = subst_get_stats();
+
+	fprintf(stderr, "ast cache: %lu hits, %lu misses, %lu evictions, %zu lines, %zu bytes\n",
+		cache->hits, cache->misses, cache->evictions,
+		cache->entries, cache->memory);
+	fprintf(stderr, "path cache: %lu hits, %lu misses, %lu invalidations, %zu commands\n",
+		paths->hits, paths->misses, paths->invalidations,
+		paths->entries);
+	fprintf(stderr, "jobs: %lu started, %lu queued, %zu most queued\n",
+		jobs->started, jobs->queued, jobs->max_queued);
+	fprintf(stderr, "env: %lu lookups (%.1f per command, at most %lu), %lu assignments, %lu envp rebuilds, %zu variables\n",
+		env->lookups,
+		env->commands ? (double)env->lookups / env->commands : 0.0,
+		env->max_command_lookups, env->assignments, env->rebuilds,
+		env->variables);
+	fprintf(stderr, "fd cache: %lu hits, %lu misses, %lu invalidations, %lu evictions, %zu descriptors\n",
+		fds->hits, fds->misses, fds->invalidations, fds->evictions,
+		fds->entries);
+	fprintf(stderr, "substitutions: %lu in process, %lu forked, %lu bytes\n",
+		subst->in_process, subst->forked, subst->bytes);
+}
+
+int main(int argc, char *argv[])
+{
+	/* The MINISHELL_* knobs are read from the store. */
+	env_init();
+	/* Before the script threads start, they inherit its signal mask. */
+	reaper_init();
+	launch_init();
+
+	if (env_getenv("MINISHELL_STATS") != NULL)
+		atexit(print_stats);
+
+	/* Queued jobs are not dropped on exit, they all run first. */
+	atexit(jobs_wait);
+
+	/* mini-shell --dump-ast out.ast script.sh precompiles a script. */
+	if (argc > 2 && strcmp(argv[1], "--dump-ast") == 0)
+		return dump_script_ast(argc > 3 ? argv[3] : NULL, argv[2]);
+
+	/* mini-shell script.sh runs a script, mini-shell -s reads it from stdin. */
+	if (argc > 1)
+		return run_script(strcmp(argv[1], "-s") == 0 ? NULL : argv[1]);
+
 	start_shell();
 
 	return EXIT_SUCCESS;
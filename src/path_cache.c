@@ -0,0 +1,225 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/stat.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "path_cache.h"
+#include "utils.h"
+
+#define PATH_BUCKETS	64
+
+struct path_entry {
+	struct path_entry *next;
+	uint64_t hash;
+	unsigned long hits;
+	char *path;
+	char name[];
+};
+
+static struct {
+	struct path_entry *buckets[PATH_BUCKETS];
+	/* Changes whenever an entry goes away. */
+	unsigned long generation;
+	struct path_cache_stats stats;
+} cache;
+
+/**
+ * FNV-1a hash of the command name.
+ */
+static uint64_t hash_name(const char *name)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *name != '\0'; name++) {
+		hash ^= (unsigned char)*name;
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static struct path_entry **cache_find(const char *name, uint64_t hash)
+{
+	struct path_entry **link = &cache.buckets[hash % PATH_BUCKETS];
+
+	for (; *link != NULL; link = &(*link)->next)
+		if ((*link)->hash == hash && strcmp((*link)->name, name) == 0)
+			break;
+
+	return link;
+}
+
+static void cache_insert(const char *name, uint64_t hash, char *path)
+{
+	size_t length = strlen(name);
+	struct path_entry *entry = malloc(sizeof(*entry) + length + 1);
+
+	DIE(entry == NULL, "Error allocating path cache entry.");
+	memcpy(entry->name, name, length + 1);
+	entry->hash = hash;
+	entry->hits = 0;
+	entry->path = path;
+	entry->next = cache.buckets[hash % PATH_BUCKETS];
+	cache.buckets[hash % PATH_BUCKETS] = entry;
+	cache.stats.entries++;
+}
+
+static void cache_remove(struct path_entry **link)
+{
+	struct path_entry *entry = *link;
+
+	*link = entry->next;
+	free(entry->path);
+	free(entry);
+	cache.stats.entries--;
+	cache.generation++;
+}
+
+/**
+ * Search PATH the way execvp does: the first executable regular file
+ * wins, an empty directory is the current one.
+ */
+static char *search_path(const char *name)
+{
+	const char *dirs = env_getenv("PATH");
+	size_t name_length = strlen(name);
+	const char *dir, *end;
+	size_t dir_length;
+	struct stat st;
+	char *path;
+
+	if (dirs == NULL)
+		dirs = DEFAULT_PATH;
+
+	for (dir = dirs; ; dir = end + 1) {
+		end = strchr(dir, ':');
+		if (end == NULL)
+			end = dir + strlen(dir);
+		dir_length = end - dir;
+
+		path = malloc(dir_length + name_length + 3);
+		DIE(path == NULL, "Error allocating path.");
+		if (dir_length == 0) {
+			memcpy(path, "./", 2);
+			dir_length = 2;
+		} else {
+			memcpy(path, dir, dir_length);
+			path[dir_length++] = '/';
+		}
+		memcpy(path + dir_length, name, name_length + 1);
+
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode) &&
+			access(path, X_OK) == 0)
+			return path;
+		free(path);
+
+		if (*end == '\0')
+			return NULL;
+	}
+}
+
+const char *path_cache_find(const char *name, struct path_entry **entry)
+{
+	struct path_entry **link;
+	uint64_t hash;
+	char *path;
+
+	*entry = NULL;
+	if (strchr(name, '/') != NULL)
+		return name;
+
+	hash = hash_name(name);
+	link = cache_find(name, hash);
+	if (*link != NULL) {
+		*entry = *link;
+		return path_cache_hit(*link);
+	}
+
+	cache.stats.misses++;
+	path = search_path(name);
+	if (path == NULL)
+		return NULL;
+
+	cache_insert(name, hash, path);
+	*entry = cache.buckets[hash % PATH_BUCKETS];
+	(*entry)->hits++;
+
+	return path;
+}
+
+const char *path_cache_lookup(const char *name)
+{
+	struct path_entry *entry;
+
+	return path_cache_find(name, &entry);
+}
+
+const char *path_cache_hit(struct path_entry *entry)
+{
+	cache.stats.hits++;
+	entry->hits++;
+	return entry->path;
+}
+
+unsigned long path_cache_generation(void)
+{
+	return cache.generation;
+}
+
+void path_cache_forget(const char *name)
+{
+	struct path_entry **link = cache_find(name, hash_name(name));
+
+	if (*link != NULL) {
+		cache_remove(link);
+		cache.stats.invalidations++;
+	}
+}
+
+void path_cache_reset(void)
+{
+	size_t i;
+
+	for (i = 0; i < PATH_BUCKETS; i++)
+		while (cache.buckets[i] != NULL)
+			cache_remove(&cache.buckets[i]);
+}
+
+void path_cache_pin(const char *name, const char *path)
+{
+	uint64_t hash = hash_name(name);
+	struct path_entry **link = cache_find(name, hash);
+	char *copy = strdup(path);
+
+	DIE(copy == NULL, "Error allocating path.");
+	if (*link != NULL)
+		cache_remove(link);
+	cache_insert(name, hash, copy);
+}
+
+void path_cache_print(int fd)
+{
+	struct path_entry *entry;
+	size_t i;
+
+	if (cache.stats.entries == 0) {
+		dprintf(fd, "hash: hash table empty\n");
+		return;
+	}
+
+	dprintf(fd, "hits\tcommand\n");
+	for (i = 0; i < PATH_BUCKETS; i++)
+		for (entry = cache.buckets[i]; entry != NULL; entry = entry->next)
+			dprintf(fd, "%4lu\t%s\n", entry->hits, entry->path);
+}
+
+const struct path_cache_stats *path_cache_get_stats(void)
+{
+	return &cache.stats;
+}
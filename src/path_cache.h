@@ -0,0 +1,65 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PATH_CACHE_H
+#define _PATH_CACHE_H
+
+#include <stddef.h>
+
+/* Search path used when PATH is not set, as execvp does. */
+#define DEFAULT_PATH	"/bin:/usr/bin"
+
+struct path_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long invalidations;
+	size_t entries;
+};
+
+/**
+ * Get the file a command runs: names holding a '/' are used as they are,
+ * other names are searched in PATH once and remembered. NULL if there is
+ * no such executable. The string is owned by the cache, it is valid
+ * until the cache changes.
+ */
+const char *path_cache_lookup(const char *name);
+
+struct path_entry;
+
+/**
+ * path_cache_lookup that also gives the entry of the command (NULL for
+ * names holding a '/' and commands not found), to use it again with
+ * path_cache_hit without a lookup. The entry is valid as long as
+ * path_cache_generation() does not change.
+ */
+const char *path_cache_find(const char *name, struct path_entry **entry);
+
+/**
+ * Count one more use of an entry and get its file.
+ */
+const char *path_cache_hit(struct path_entry *entry);
+
+unsigned long path_cache_generation(void);
+
+/**
+ * Forget a command whose remembered file vanished (lazy revalidation).
+ */
+void path_cache_forget(const char *name);
+
+/**
+ * Forget every command; done when PATH is assigned and by hash -r.
+ */
+void path_cache_reset(void);
+
+/**
+ * Remember path as the file of a command without searching (hash -p).
+ */
+void path_cache_pin(const char *name, const char *path);
+
+/**
+ * List the remembered commands and their hits, in the format of bash.
+ */
+void path_cache_print(int fd);
+
+const struct path_cache_stats *path_cache_get_stats(void);
+
+#endif /* _PATH_CACHE_H */
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "path_cache.h"
+#include "plan.h"
+#include "utils.h"
+
+static bool part_equals(word_t *part, const char *str)
+{
+	size_t length = strlen(str);
+
+	return part->length == length && memcmp(part->string, str, length) == 0;
+}
+
+/**
+ * Whether a word has no variable nor command, and then its length once
+ * joined.
+ */
+static bool word_literal(word_t *word, size_t *length)
+{
+	*length = 0;
+	for (; word != NULL; word = word->next_part) {
+		if (word->expand || word->command != NULL)
+			return false;
+		*length += word->length;
+	}
+
+	return true;
+}
+
+/**
+ * Join the parts of a literal word at text, null terminated; returns
+ * the end of the copy.
+ */
+static char *join_word(char *text, word_t *word)
+{
+	for (; word != NULL; word = word->next_part) {
+		memcpy(text, word->string, word->length);
+		text += word->length;
+	}
+	*text++ = '\0';
+
+	return text;
+}
+
+/**
+ * Whether a list of words has $(...) parts.
+ */
+static bool words_substitute(word_t *word)
+{
+	word_t *part;
+
+	for (; word != NULL; word = word->next_word)
+		for (part = word; part != NULL; part = part->next_part)
+			if (part->command != NULL)
+				return true;
+
+	return false;
+}
+
+static void release_substitutions(word_t *word)
+{
+	word_t *part;
+
+	for (; word != NULL; word = word->next_word)
+		for (part = word; part != NULL; part = part->next_part)
+			plan_release(part->command);
+}
+
+/**
+ * Whether the builtin cat handles these arguments: files, - and -u.
+ * A word that may expand to some other option leaves it to /bin/cat.
+ */
+static bool cat_operands(word_t *word)
+{
+	char option[3];
+	word_t *part;
+	size_t length;
+
+	for (; word != NULL; word = word->next_word) {
+		for (part = word; part != NULL && part->length == 0 &&
+			!part->expand && part->command == NULL;
+			part = part->next_part)
+			;
+		if (part == NULL || (!part->expand && part->command == NULL &&
+			part->string[0] != '-'))
+			continue;
+
+		if (!word_literal(word, &length) || length >= sizeof(option))
+			return false;
+		join_word(option, word);
+		if (strcmp(option, "-") != 0 && strcmp(option, "-u") != 0)
+			return false;
+	}
+
+	return true;
+}
+
+static enum plan_kind plan_kind(simple_command_t *s, builtin_fn *builtin)
+{
+	*builtin = NULL;
+
+	/* The name comes from the output of a command, it may be anything. */
+	if (s->verb->command != NULL)
+		return PLAN_EXTERNAL;
+
+	if (part_equals(s->verb, "cd"))
+		return PLAN_CD;
+
+	if (part_equals(s->verb, "exit") || part_equals(s->verb, "quit"))
+		return PLAN_EXIT;
+
+	if (part_equals(s->verb, "hash") && s->verb->next_part == NULL)
+		return PLAN_HASH;
+
+	if (part_equals(s->verb, "wait") && s->verb->next_part == NULL)
+		return PLAN_WAIT;
+
+	if (s->verb->next_part == NULL) {
+		*builtin = builtin_lookup(s->verb->string, s->verb->length);
+		if (*builtin != NULL && (!builtin_is_cat(*builtin) ||
+			cat_operands(s->params)))
+			return PLAN_BUILTIN;
+		*builtin = NULL;
+	}
+
+	if (s->verb->next_part && s->verb->next_part->length > 0 &&
+		s->verb->next_part->string[0] == '=')
+		return PLAN_ASSIGNMENT;
+
+	return PLAN_EXTERNAL;
+}
+
+/*
+ * The plan, its argv and words slots and the joined literal words are
+ * one allocation.
+ */
+static struct plan *plan_compile(simple_command_t *s)
+{
+	word_t *io[3] = { s->in, s->out, s->err };
+	size_t argc = 1, size = 0, length, i;
+	struct plan *plan;
+	word_t *word;
+	char *text;
+
+	for (word = s->params; word != NULL; word = word->next_word)
+		argc++;
+
+	for (word = s->verb, i = 0; i < argc; i++) {
+		if (word_literal(word, &length))
+			size += length + 1;
+		word = i == 0 ? s->params : word->next_word;
+	}
+	for (i = 0; i < 3; i++)
+		if (io[i] != NULL && word_literal(io[i], &length))
+			size += length + 1;
+
+	plan = malloc(sizeof(*plan) + (argc + 1) * sizeof(char *) +
+		argc * sizeof(word_t *) + size);
+	DIE(plan == NULL, "Error allocating a plan.");
+
+	plan->kind = plan_kind(s, &plan->builtin);
+	plan->argc = argc;
+	plan->literal = true;
+	plan->argv = (char **)(plan + 1);
+	plan->words = (word_t **)(plan->argv + argc + 1);
+	plan->entry = NULL;
+	plan->generation = 0;
+	text = (char *)(plan->words + argc);
+
+	for (word = s->verb, i = 0; i < argc; i++) {
+		plan->words[i] = word;
+		plan->argv[i] = NULL;
+		if (word_literal(word, &length)) {
+			plan->argv[i] = text;
+			text = join_word(text, word);
+		} else {
+			plan->literal = false;
+		}
+		word = i == 0 ? s->params : word->next_word;
+	}
+	plan->argv[argc] = NULL;
+
+	for (i = 0; i < 3; i++) {
+		plan->io[i] = io[i];
+		plan->io_literal[i] = NULL;
+		if (io[i] != NULL && word_literal(io[i], &length)) {
+			plan->io_literal[i] = text;
+			text = join_word(text, io[i]);
+		}
+	}
+
+	plan->has_here = s->io_flags & (IO_HERE_STRING | IO_HERE_DOC);
+	plan->here = s->here;
+	plan->substitutes = words_substitute(s->verb) ||
+		words_substitute(s->params) || words_substitute(s->in) ||
+		words_substitute(s->out) || words_substitute(s->err) ||
+		words_substitute(s->here);
+
+	plan->io_flags[STDIN_FILENO] = O_RDONLY;
+	plan->io_flags[STDOUT_FILENO] = O_WRONLY | O_CREAT |
+		(s->io_flags & IO_OUT_APPEND ? O_APPEND : O_TRUNC);
+	plan->io_flags[STDERR_FILENO] = O_WRONLY | O_CREAT |
+		(s->io_flags & IO_ERR_APPEND ? O_APPEND : O_TRUNC);
+
+	return plan;
+}
+
+struct plan *plan_get(simple_command_t *s)
+{
+	if (s->aux == NULL)
+		s->aux = plan_compile(s);
+
+	return s->aux;
+}
+
+char **plan_argv(struct plan *plan, struct expansion *e, int *argc)
+{
+	*argc = plan->argc;
+	if (plan->literal)
+		return plan->argv;
+
+	return expand_argv(e, plan->words, plan->argv, plan->argc);
+}
+
+void plan_io_names(struct plan *plan, struct expansion *e,
+		const char *names[3], size_t lengths[3])
+{
+	size_t offsets[3];
+	int i;
+
+	/* Every name is expanded before the buffer is read, it may move. */
+	for (i = 0; i < 3; i++)
+		if (plan->io[i] != NULL && plan->io_literal[i] == NULL)
+			offsets[i] = expand_word(e, plan->io[i], &lengths[i]);
+
+	for (i = 0; i < 3; i++) {
+		names[i] = plan->io_literal[i];
+		if (plan->io[i] == NULL)
+			continue;
+
+		if (names[i] != NULL)
+			lengths[i] = strlen(names[i]);
+		else
+			names[i] = expansion_at(e, offsets[i]);
+	}
+}
+
+const char *plan_path(struct plan *plan, const char *argv0)
+{
+	const char *path;
+
+	/* A name built from variables may change on every run. */
+	if (plan->argv[0] == NULL)
+		return path_cache_lookup(argv0);
+
+	if (plan->entry != NULL &&
+		plan->generation == path_cache_generation())
+		return path_cache_hit(plan->entry);
+
+	path = path_cache_find(argv0, &plan->entry);
+	plan->generation = path_cache_generation();
+
+	return path;
+}
+
+void plan_release(command_t *root)
+{
+	simple_command_t *s;
+	struct plan *plan;
+
+	/* Sequences and pipelines grow to the left, walk that side in a loop. */
+	for (; root != NULL; root = root->cmd1) {
+		s = root->scmd;
+		plan = s != NULL ? s->aux : NULL;
+		if (plan != NULL && plan->substitutes) {
+			/* The trees of the $(...) parts have plans of their own. */
+			release_substitutions(s->verb);
+			release_substitutions(s->params);
+			release_substitutions(s->in);
+			release_substitutions(s->out);
+			release_substitutions(s->err);
+			release_substitutions(s->here);
+		}
+		if (s != NULL) {
+			free(plan);
+			s->aux = NULL;
+		}
+		plan_release(root->cmd2);
+	}
+}
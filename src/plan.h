@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _PLAN_H
+#define _PLAN_H
+
+#include <stddef.h>
+
+#include "../util/parser/parser.h"
+#include "builtins.h"
+#include "expand.h"
+
+/*
+ * Execution plans: the first time a simple command runs, what does not
+ * depend on the variables is worked out once and kept in its aux field:
+ * the kind of command, the builtin function, the words that have no
+ * variable (already joined), the words left to expand, the flags of the
+ * redirections and the file of the command. A tree that runs again (a
+ * line of the AST cache, an AST image) only fills in the variables.
+ */
+
+enum plan_kind {
+	PLAN_EXTERNAL,
+	PLAN_CD,
+	PLAN_EXIT,
+	PLAN_HASH,
+	PLAN_WAIT,
+	PLAN_BUILTIN,
+	PLAN_ASSIGNMENT,
+};
+
+struct path_entry;
+
+struct plan {
+	enum plan_kind kind;
+	builtin_fn builtin;
+	int argc;
+	/* Every argument is literal, argv is complete. */
+	bool literal;
+	/* argc + 1 slots, NULL for the words to expand. */
+	char **argv;
+	word_t **words;
+	/* The redirections (in, out, err): word NULL if there is none. */
+	word_t *io[3];
+	const char *io_literal[3];
+	int io_flags[3];
+	/* The input of a here-document or here-string, expanded every run. */
+	bool has_here;
+	word_t *here;
+	/* Some words have $(...) parts, whose trees get plans too. */
+	bool substitutes;
+	/* The file of the command, valid for this path cache generation. */
+	struct path_entry *entry;
+	unsigned long generation;
+};
+
+/**
+ * Get the plan of a simple command, compiling it on first use.
+ */
+struct plan *plan_get(simple_command_t *s);
+
+/**
+ * The arguments of the command: the argv of the plan when every word is
+ * literal, else one built in e. The strings must not be modified.
+ */
+char **plan_argv(struct plan *plan, struct expansion *e, int *argc);
+
+/**
+ * The names of the redirection files (NULL for the streams that are not
+ * redirected) and their lengths, the variables expanded in e.
+ */
+void plan_io_names(struct plan *plan, struct expansion *e,
+		const char *names[3], size_t lengths[3]);
+
+/**
+ * The file to run for the command named argv0; NULL if there is none.
+ */
+const char *plan_path(struct plan *plan, const char *argv0);
+
+/**
+ * Free the plans of a tree before it is freed or reused.
+ */
+void plan_release(command_t *root);
+
+#endif /* _PLAN_H */
@@ -0,0 +1,310 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "env.h"
+#include "reaper.h"
+#include "utils.h"
+
+/* Older headers lack it; the number is the same on every architecture. */
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open	434
+#endif
+
+#define REAPER_EVENTS	64
+
+struct child {
+	struct child *next;
+	pid_t pid;
+	int pidfd;
+	reaper_done_t done;
+	void *arg;
+};
+
+enum reaper_method reaper_method = REAPER_PIDFD;
+
+/*
+ * The children are also kept in a table by pid, which the signalfd
+ * method needs to map the pids waitpid returns back to them; it grows
+ * with the number of children, so lookups stay O(1).
+ */
+static struct {
+	int epoll_fd;
+	int signal_fd;
+	struct child **buckets;
+	size_t size;
+	size_t count;
+} reaper = { -1, -1, NULL, 0, 0 };
+
+static int pidfd_open(pid_t pid)
+{
+	return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/**
+ * Exit code of a child from its wait status, 128 + the signal number if
+ * it was killed, as in other shells.
+ */
+static int exit_code(int status)
+{
+	if (WIFSIGNALED(status))
+		return 128 + WTERMSIG(status);
+
+	return WEXITSTATUS(status);
+}
+
+void reaper_init(void)
+{
+	const char *method = env_getenv("MINISHELL_REAPER");
+	sigset_t mask;
+	int fd;
+
+	if (method != NULL && strcmp(method, "signalfd") == 0) {
+		reaper_method = REAPER_SIGNALFD;
+	} else {
+		fd = pidfd_open(getpid());
+		if (fd < 0)
+			reaper_method = REAPER_SIGNALFD;
+		else
+			close(fd);
+	}
+
+	if (reaper_method == REAPER_SIGNALFD) {
+		sigemptyset(&mask);
+		sigaddset(&mask, SIGCHLD);
+		DIE(sigprocmask(SIG_BLOCK, &mask, NULL) < 0, "sigprocmask");
+	}
+}
+
+/**
+ * The epoll set is created with the first child.
+ */
+static void reaper_open(void)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.u64 = 0 };
+	sigset_t mask;
+
+	reaper.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	DIE(reaper.epoll_fd < 0, "epoll_create1");
+
+	if (reaper_method != REAPER_SIGNALFD)
+		return;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	reaper.signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	DIE(reaper.signal_fd < 0, "signalfd");
+	DIE(epoll_ctl(reaper.epoll_fd, EPOLL_CTL_ADD, reaper.signal_fd,
+		&event) < 0, "epoll_ctl");
+}
+
+static struct child **table_find(pid_t pid)
+{
+	struct child **link = &reaper.buckets[pid & (reaper.size - 1)];
+
+	while (*link != NULL && (*link)->pid != pid)
+		link = &(*link)->next;
+
+	return link;
+}
+
+static void table_grow(void)
+{
+	size_t size = reaper.size ? 2 * reaper.size : 64;
+	struct child **buckets = calloc(size, sizeof(*buckets));
+	struct child *child, *next;
+	size_t i;
+
+	DIE(buckets == NULL, "Error allocating the child table.");
+
+	for (i = 0; i < reaper.size; i++)
+		for (child = reaper.buckets[i]; child != NULL; child = next) {
+			next = child->next;
+			child->next = buckets[child->pid & (size - 1)];
+			buckets[child->pid & (size - 1)] = child;
+		}
+
+	free(reaper.buckets);
+	reaper.buckets = buckets;
+	reaper.size = size;
+}
+
+void reaper_watch(pid_t pid, reaper_done_t done, void *arg)
+{
+	struct epoll_event event = { .events = EPOLLIN };
+	struct child *child, **link;
+
+	if (reaper.epoll_fd < 0)
+		reaper_open();
+	if (reaper.count >= reaper.size)
+		table_grow();
+
+	child = malloc(sizeof(*child));
+	DIE(child == NULL, "Error allocating child.");
+	child->pid = pid;
+	child->pidfd = -1;
+	child->done = done;
+	child->arg = arg;
+
+	if (reaper_method == REAPER_PIDFD) {
+		child->pidfd = pidfd_open(pid);
+		DIE(child->pidfd < 0, "pidfd_open");
+		event.data.u64 = pid;
+		DIE(epoll_ctl(reaper.epoll_fd, EPOLL_CTL_ADD, child->pidfd,
+			&event) < 0, "epoll_ctl");
+	}
+
+	link = &reaper.buckets[pid & (reaper.size - 1)];
+	child->next = *link;
+	*link = child;
+	reaper.count++;
+}
+
+/**
+ * Forget a child that was reaped, then run its callback (which may start
+ * and watch other children).
+ */
+static void child_exited(struct child *child, int code)
+{
+	reaper_done_t done = child->done;
+	void *arg = child->arg;
+	pid_t pid = child->pid;
+
+	*table_find(pid) = child->next;
+	reaper.count--;
+
+	if (child->pidfd >= 0) {
+		epoll_ctl(reaper.epoll_fd, EPOLL_CTL_DEL, child->pidfd, NULL);
+		close(child->pidfd);
+	}
+	free(child);
+
+	done(pid, code, arg);
+}
+
+/**
+ * A readable pidfd means that its child exited. The event names the
+ * child by pid: a callback may poll again and reap it before its event
+ * from an outer poll is handled, which then finds it gone.
+ */
+static void reap_child(pid_t watched)
+{
+	struct child *child = *table_find(watched);
+	int status;
+	pid_t pid;
+
+	if (child == NULL)
+		return;
+
+	do {
+		pid = waitpid(child->pid, &status, WNOHANG);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid == child->pid)
+		child_exited(child, exit_code(status));
+	else if (pid < 0)
+		child_exited(child, FAILURE_CODE);
+}
+
+/**
+ * SIGCHLD signals coalesce: drain the signalfd, then reap every child
+ * that exited.
+ */
+static void reap_signalled(void)
+{
+	struct signalfd_siginfo info;
+	struct child *child;
+	int status;
+	pid_t pid;
+
+	while (read(reaper.signal_fd, &info, sizeof(info)) == sizeof(info))
+		;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		child = *table_find(pid);
+		if (child != NULL)
+			child_exited(child, exit_code(status));
+	}
+}
+
+void reaper_poll(bool block)
+{
+	struct epoll_event events[REAPER_EVENTS];
+	int ready, i;
+
+	if (reaper.count == 0)
+		return;
+
+	ready = epoll_wait(reaper.epoll_fd, events, REAPER_EVENTS,
+		block ? -1 : 0);
+
+	for (i = 0; i < ready; i++) {
+		if (events[i].data.u64 == 0)
+			reap_signalled();
+		else
+			reap_child(events[i].data.u64);
+	}
+}
+
+struct wait_result {
+	int code;
+	bool done;
+};
+
+static void store_code(pid_t pid, int code, void *arg)
+{
+	struct wait_result *result = arg;
+
+	result->code = code;
+	result->done = true;
+}
+
+int reaper_wait(pid_t pid)
+{
+	struct wait_result result = { FAILURE_CODE, false };
+
+	reaper_watch(pid, store_code, &result);
+	while (!result.done)
+		reaper_poll(true);
+
+	return result.code;
+}
+
+void reaper_forget(void)
+{
+	struct child *child, *next;
+	size_t i;
+
+	/* The epoll set is shared with the parent, it must stay untouched. */
+	for (i = 0; i < reaper.size; i++)
+		for (child = reaper.buckets[i]; child != NULL; child = next) {
+			next = child->next;
+			if (child->pidfd >= 0)
+				close(child->pidfd);
+			free(child);
+		}
+
+	free(reaper.buckets);
+	reaper.buckets = NULL;
+	reaper.size = 0;
+	reaper.count = 0;
+
+	if (reaper.epoll_fd >= 0)
+		close(reaper.epoll_fd);
+	if (reaper.signal_fd >= 0)
+		close(reaper.signal_fd);
+	reaper.epoll_fd = -1;
+	reaper.signal_fd = -1;
+}
@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _REAPER_H
+#define _REAPER_H
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Central reaper: every child the shell starts is watched here and its
+ * completion callback runs when it exits, in whatever order the children
+ * finish. Each child is a pidfd in an epoll set, so an exit is found and
+ * reaped in O(1) however many children run. Kernels without pidfd_open
+ * (before 5.3) get a signalfd for SIGCHLD in the set instead, with
+ * SIGCHLD blocked; MINISHELL_REAPER=signalfd selects it anywhere.
+ */
+enum reaper_method {
+	REAPER_PIDFD,
+	REAPER_SIGNALFD
+};
+
+extern enum reaper_method reaper_method;
+
+/* Called with the exit code of the child (128 + signal if killed). */
+typedef void (*reaper_done_t)(pid_t pid, int code, void *arg);
+
+/**
+ * Pick the method; done before the shell starts any thread, since
+ * SIGCHLD must be blocked in all of them for the signalfd.
+ */
+void reaper_init(void);
+
+/**
+ * Watch a child; done right after starting it, before the next
+ * reaper_poll.
+ */
+void reaper_watch(pid_t pid, reaper_done_t done, void *arg);
+
+/**
+ * Reap the children that exited and run their callbacks; with block,
+ * wait until at least one exits (returns at once if none is watched).
+ * A callback may call it again, e.g. to wait for a $(...) child.
+ */
+void reaper_poll(bool block);
+
+/**
+ * Wait for one child, reaping the others that exit meanwhile; returns
+ * its exit code.
+ */
+int reaper_wait(pid_t pid);
+
+/**
+ * Drop the parent's children, in a forked child of the shell.
+ */
+void reaper_forget(void);
+
+#endif /* _REAPER_H */
@@ -0,0 +1,495 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../util/parser/parser.h"
+#include "../util/parser/ast_image.h"
+#include "cmd.h"
+#include "line_reader.h"
+#include "plan.h"
+#include "script.h"
+#include "utils.h"
+
+/*
+ * Input read from a pipe is kept in blocks that never move, since the
+ * parsed trees point into them; a block is freed once no queued line
+ * uses it any more. Every block keeps two spare bytes after its data
+ * for the sentinels the lexer needs.
+ */
+struct script_block {
+	int refs;
+	size_t size;
+	size_t capacity;
+	char data[];
+};
+
+/* A line parsed ahead of execution. */
+struct script_slot {
+	parser_ctx_t *ctx;
+	command_t *root;
+	struct script_block *block;
+	char error[PARSE_ERROR_SIZE];
+	struct script_slot *next;
+};
+
+struct script {
+	int fd;
+
+	/*
+	 * Regular files are mapped read only, their pages stay the page
+	 * cache's: writing the lexer's sentinels in them would make a private
+	 * copy of every page, so each line is copied to the parser instead.
+	 */
+	char *map;
+	size_t map_size;
+	size_t map_pos;
+
+	/* Anything else is read into blocks. */
+	struct script_block *block;
+	size_t block_pos;
+	bool eof;
+
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_cond_t released;
+	struct script_slot slots[SCRIPT_AHEAD];
+	struct script_slot *free_slots;
+	struct script_slot *queue_head;
+	struct script_slot *queue_tail;
+	bool done;
+	bool stop;
+};
+
+/**
+ * Drop a reference to a block, called with the lock held.
+ */
+static void block_put(struct script_block *block)
+{
+	if (block != NULL && --block->refs == 0)
+		free(block);
+}
+
+static struct script_block *block_new(size_t capacity)
+{
+	struct script_block *block = malloc(sizeof(*block) + capacity + 2);
+
+	DIE(block == NULL, "Error allocating script block");
+	block->refs = 1;
+	block->size = 0;
+	block->capacity = capacity;
+
+	return block;
+}
+
+/**
+ * Get the next line of a mapped script.
+ */
+static bool next_mapped_line(struct script *s, char **line, size_t *length)
+{
+	char *start = s->map + s->map_pos;
+	size_t avail = s->map_size - s->map_pos;
+	char *newline;
+
+	if (avail == 0)
+		return false;
+
+	newline = memchr(start, '\n', avail);
+	*line = start;
+	*length = newline ? (size_t)(newline - start) : avail;
+	s->map_pos += *length + (newline ? 1 : 0);
+
+	return true;
+}
+
+/**
+ * Get the next line read from a pipe, reading more blocks as needed.
+ * Only the unfinished line at the end of a full block is ever copied.
+ */
+static bool next_stream_line(struct script *s, char **line, size_t *length)
+{
+	struct script_block *block;
+	char *newline;
+	size_t avail;
+	ssize_t n;
+
+	for (;;) {
+		block = s->block;
+		avail = block->size - s->block_pos;
+
+		newline = memchr(block->data + s->block_pos, '\n', avail);
+		if (newline != NULL || (s->eof && avail > 0)) {
+			*line = block->data + s->block_pos;
+			*length = newline ? (size_t)(newline - *line) : avail;
+			s->block_pos += *length + (newline ? 1 : 0);
+			return true;
+		}
+
+		if (s->eof)
+			return false;
+
+		if (block->capacity - block->size < SCRIPT_BLOCK_SIZE / 4) {
+			/* Move the unfinished line to a new block. */
+			block = block_new(avail > SCRIPT_BLOCK_SIZE / 2 ?
+				2 * avail + SCRIPT_BLOCK_SIZE : SCRIPT_BLOCK_SIZE);
+			memcpy(block->data, s->block->data + s->block_pos, avail);
+			block->size = avail;
+
+			pthread_mutex_lock(&s->lock);
+			block_put(s->block);
+			pthread_mutex_unlock(&s->lock);
+
+			s->block = block;
+			s->block_pos = 0;
+		}
+
+		n = read(s->fd, block->data + block->size,
+			block->capacity - block->size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			perror("Error reading script");
+		if (n <= 0)
+			s->eof = true;
+		else
+			block->size += n;
+	}
+}
+
+/**
+ * Parse a line in place: the two bytes after it are temporarily replaced
+ * by the sentinels the lexer needs. The tree never points past the line,
+ * so they can be restored right away.
+ */
+static bool parse_in_place(parser_ctx_t *ctx, char *line, size_t length,
+		command_t **root)
+{
+	char saved[2] = { line[length], line[length + 1] };
+	bool ret;
+
+	line[length] = line[length + 1] = '\0';
+	ret = parse_line_buffer_r(ctx, line, length, root);
+	line[length] = saved[0];
+	line[length + 1] = saved[1];
+
+	return ret;
+}
+
+static bool next_line(struct script *s, char **line, size_t *length)
+{
+	if (s->map != NULL)
+		return next_mapped_line(s, line, length);
+
+	return next_stream_line(s, line, length);
+}
+
+/**
+ * Parser thread: fill free slots with the next lines, in order.
+ */
+static void *parse_ahead(void *arg)
+{
+	struct script *s = arg;
+	struct script_slot *slot;
+	char *line;
+	size_t length;
+
+	for (;;) {
+		if (!next_line(s, &line, &length))
+			break;
+
+		/* Windows line ending */
+		if (length > 0 && line[length - 1] == '\r')
+			length--;
+
+		pthread_mutex_lock(&s->lock);
+		while (s->free_slots == NULL && !s->stop)
+			pthread_cond_wait(&s->released, &s->lock);
+		if (s->stop) {
+			pthread_mutex_unlock(&s->lock);
+			break;
+		}
+		slot = s->free_slots;
+		s->free_slots = slot->next;
+		slot->block = s->block;
+		if (slot->block != NULL)
+			slot->block->refs++;
+		pthread_mutex_unlock(&s->lock);
+
+		slot->root = NULL;
+		slot->error[0] = '\0';
+		deferred_parse_error = slot->error;
+		if (s->map == NULL)
+			parse_in_place(slot->ctx, line, length, &slot->root);
+		else
+			parse_line_r(slot->ctx, line, length, &slot->root);
+
+		/* The lines after a here-document are its body, copied. */
+		while (parse_heredoc_pending_r(slot->ctx) &&
+			next_line(s, &line, &length) &&
+			parse_heredoc_line_r(slot->ctx, line, length))
+			;
+
+		pthread_mutex_lock(&s->lock);
+		slot->next = NULL;
+		if (s->queue_tail)
+			s->queue_tail->next = slot;
+		else
+			s->queue_head = slot;
+		s->queue_tail = slot;
+		pthread_cond_signal(&s->ready);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->done = true;
+	pthread_cond_signal(&s->ready);
+	pthread_mutex_unlock(&s->lock);
+
+	return NULL;
+}
+
+/**
+ * Wait for the next parsed line; NULL at the end of the script.
+ */
+static struct script_slot *next_slot(struct script *s)
+{
+	struct script_slot *slot;
+
+	pthread_mutex_lock(&s->lock);
+	while (s->queue_head == NULL && !s->done)
+		pthread_cond_wait(&s->ready, &s->lock);
+
+	slot = s->queue_head;
+	if (slot != NULL) {
+		s->queue_head = slot->next;
+		if (s->queue_head == NULL)
+			s->queue_tail = NULL;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return slot;
+}
+
+static void release_slot(struct script *s, struct script_slot *slot)
+{
+	plan_release(slot->root);
+
+	pthread_mutex_lock(&s->lock);
+	block_put(slot->block);
+	slot->block = NULL;
+	slot->next = s->free_slots;
+	s->free_slots = slot;
+	pthread_cond_signal(&s->released);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * Map regular files, use blocks for everything else.
+ */
+static bool open_script(struct script *s, const char *path)
+{
+	struct stat st;
+
+	s->fd = path ? open(path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+	if (s->fd < 0) {
+		perror(path);
+		return false;
+	}
+
+	if (fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		s->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			s->fd, 0);
+		if (s->map != MAP_FAILED) {
+			s->map_size = st.st_size;
+			madvise(s->map, s->map_size, MADV_SEQUENTIAL);
+			return true;
+		}
+		s->map = NULL;
+	}
+
+	s->block = block_new(SCRIPT_BLOCK_SIZE);
+
+	return true;
+}
+
+/**
+ * Run the trees of a precompiled script, relocated in its mapping.
+ */
+static int run_image(char *map, size_t size, const char *path)
+{
+	struct ast_image *image = ast_image_open(map, size);
+	command_t *root;
+	int ret = SUCCESS_CODE;
+	size_t i;
+
+	if (image == NULL) {
+		fprintf(stderr, "%s: invalid or incompatible AST image\n", path);
+		return FAILURE_CODE;
+	}
+
+	for (i = 0; i < ast_image_count(image); i++) {
+		root = ast_image_root(image, i);
+		if (root != NULL)
+			ret = parse_command(root, 0, NULL);
+
+		if (ret == SHELL_EXIT)
+			break;
+	}
+
+	for (i = 0; i < ast_image_count(image); i++)
+		plan_release(ast_image_root(image, i));
+	ast_image_close(image);
+
+	return ret;
+}
+
+int run_script(const char *path)
+{
+	struct script s;
+	struct script_slot *slot;
+	pthread_t parser;
+	int ret = SUCCESS_CODE;
+	int i;
+
+	memset(&s, 0, sizeof(s));
+	if (!open_script(&s, path))
+		return FAILURE_CODE;
+
+	/* An image is relocated in place, in private copies of its pages. */
+	if (s.map != NULL && ast_image_probe(s.map, s.map_size) &&
+		mprotect(s.map, s.map_size, PROT_READ | PROT_WRITE) == 0) {
+		ret = run_image(s.map, s.map_size, path);
+		munmap(s.map, s.map_size);
+		close(s.fd);
+		return ret;
+	}
+
+	pthread_mutex_init(&s.lock, NULL);
+	pthread_cond_init(&s.ready, NULL);
+	pthread_cond_init(&s.released, NULL);
+	for (i = 0; i < SCRIPT_AHEAD; i++) {
+		s.slots[i].ctx = parser_ctx_create();
+		s.slots[i].next = s.free_slots;
+		s.free_slots = &s.slots[i];
+	}
+
+	DIE(pthread_create(&parser, NULL, parse_ahead, &s) != 0,
+		"Error starting the parser thread");
+
+	while ((slot = next_slot(&s)) != NULL) {
+		if (slot->error[0] != '\0')
+			fputs(slot->error, stderr);
+
+		if (slot->root != NULL)
+			ret = parse_command(slot->root, 0, NULL);
+
+		release_slot(&s, slot);
+
+		if (ret == SHELL_EXIT)
+			break;
+	}
+
+	/* exit/quit leave through exit(), the parser thread only ends here. */
+	pthread_mutex_lock(&s.lock);
+	s.stop = true;
+	pthread_cond_signal(&s.released);
+	pthread_mutex_unlock(&s.lock);
+	pthread_join(parser, NULL);
+
+	while ((slot = next_slot(&s)) != NULL)
+		release_slot(&s, slot);
+
+	for (i = 0; i < SCRIPT_AHEAD; i++)
+		parser_ctx_destroy(s.slots[i].ctx);
+	block_put(s.block);
+	if (s.map != NULL)
+		munmap(s.map, s.map_size);
+	if (path != NULL)
+		close(s.fd);
+
+	return ret;
+}
+
+int dump_script_ast(const char *path, const char *output)
+{
+	struct line_reader input;
+	struct ast_writer *writer;
+	parser_ctx_t *ctx;
+	command_t *root;
+	size_t length, size, done = 0, lineno = 0;
+	int fd, ret = SUCCESS_CODE;
+	char *line, *image;
+	ssize_t n;
+
+	fd = path ? open(path, O_RDONLY | O_CLOEXEC) : STDIN_FILENO;
+	if (fd < 0) {
+		perror(path);
+		return FAILURE_CODE;
+	}
+
+	ctx = parser_ctx_create();
+	writer = ast_writer_create();
+	DIE(ctx == NULL || writer == NULL, "Error creating the AST writer");
+
+	/* The image must run exactly like the script, refuse broken lines. */
+	line_reader_init(&input, fd);
+	while ((line = line_reader_next(&input, &length)) != NULL) {
+		lineno++;
+		root = NULL;
+		if (!parse_line_r(ctx, line, length, &root)) {
+			fprintf(stderr, "%s:%zu: not dumped\n",
+				path ? path : "stdin", lineno);
+			ret = FAILURE_CODE;
+			break;
+		}
+
+		/* The bodies of the here-documents are stored in the tree. */
+		while (parse_heredoc_pending_r(ctx) &&
+			(line = line_reader_next(&input, &length)) != NULL &&
+			parse_heredoc_line_r(ctx, line, length))
+			lineno++;
+		ast_writer_add(writer, root);
+	}
+	line_reader_destroy(&input);
+	parser_ctx_destroy(ctx);
+	if (path != NULL)
+		close(fd);
+
+	image = ast_writer_finish(writer, &size);
+	if (ret != SUCCESS_CODE) {
+		free(image);
+		return ret;
+	}
+
+	fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror(output);
+		free(image);
+		return FAILURE_CODE;
+	}
+
+	while (done < size) {
+		n = write(fd, image + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror(output);
+			ret = FAILURE_CODE;
+			break;
+		}
+		done += n;
+	}
+
+	close(fd);
+	free(image);
+
+	return ret;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SCRIPT_H
+#define _SCRIPT_H
+
+/* Number of lines parsed ahead of the one being executed. */
+#define SCRIPT_AHEAD		16
+/* Size of the blocks read from pipes and terminals. */
+#define SCRIPT_BLOCK_SIZE	(1 << 20)
+
+/**
+ * Run a script file, or the standard input when path is NULL. Regular
+ * files are mapped read only, anything else is read in large blocks, in
+ * which lines are parsed in place; a separate thread parses the lines
+ * ahead of execution.
+ * Files holding an AST image (see util/parser/ast_image.h) are run
+ * without parsing. Returns the exit code of the last command.
+ */
+int run_script(const char *path);
+
+/**
+ * Parse a script (stdin when path is NULL) and save the trees of all its
+ * lines as an AST image in output, to be run later by run_script.
+ * Fails without writing the image if a line does not parse.
+ */
+int dump_script_ast(const char *path, const char *output);
+
+#endif /* _SCRIPT_H */
@@ -0,0 +1,132 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/* fopencookie, pipe2 */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtins.h"
+#include "cmd.h"
+#include "env.h"
+#include "plan.h"
+#include "reaper.h"
+#include "subst.h"
+
+/* Room made in the buffer before each read from the pipe. */
+#define CAPTURE_READ	(64 << 10)
+
+static struct subst_stats stats;
+
+static ssize_t capture_write(void *cookie, const char *data, size_t length)
+{
+	struct expansion *e = cookie;
+
+	expansion_reserve(e, length);
+	memcpy(e->data + e->length, data, length);
+	e->length += length;
+
+	return length;
+}
+
+static bool runs_in_process(command_t *c)
+{
+	struct plan *plan;
+
+	if (c->op != OP_NONE)
+		return false;
+
+	plan = plan_get(c->scmd);
+
+	return plan->kind == PLAN_BUILTIN && builtin_is_pure(plan->builtin) &&
+		plan->io[STDIN_FILENO] == NULL &&
+		plan->io[STDOUT_FILENO] == NULL &&
+		plan->io[STDERR_FILENO] == NULL && !plan->has_here;
+}
+
+/**
+ * The builtin writes to a stdio stream whose writes append to e, in
+ * place of stdout while it runs.
+ */
+static bool capture_builtin(struct expansion *e, simple_command_t *s)
+{
+	cookie_io_functions_t io = { .write = capture_write };
+	struct expansion words = EXPANSION_INIT;
+	struct plan *plan = plan_get(s);
+	FILE *capture, *saved = stdout;
+	char **argv;
+	int argc;
+
+	capture = fopencookie(e, "w", io);
+	if (capture == NULL)
+		return false;
+
+	argv = plan_argv(plan, &words, &argc);
+	fflush(stdout);
+	stdout = capture;
+	plan->builtin(argc, argv);
+	fclose(capture);
+	stdout = saved;
+
+	expansion_free(&words);
+	env_command_done();
+
+	return true;
+}
+
+static void capture_child(struct expansion *e, command_t *c)
+{
+	int fds[2];
+	ssize_t n;
+	pid_t pid;
+
+	if (pipe2(fds, O_CLOEXEC) < 0) {
+		perror("pipe");
+		return;
+	}
+
+	pid = start_command(c, fds[1]);
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		return;
+	}
+
+	for (;;) {
+		expansion_reserve(e, CAPTURE_READ);
+		n = read(fds[0], e->data + e->length, e->capacity - e->length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		e->length += n;
+	}
+
+	close(fds[0]);
+	reaper_wait(pid);
+}
+
+void substitute(struct expansion *e, command_t *c)
+{
+	size_t start = e->length;
+
+	if (runs_in_process(c) && capture_builtin(e, c->scmd)) {
+		stats.in_process++;
+	} else {
+		capture_child(e, c);
+		stats.forked++;
+	}
+
+	/* The new lines at the end are cut off where they are. */
+	while (e->length > start && e->data[e->length - 1] == '\n')
+		e->length--;
+	stats.bytes += e->length - start;
+}
+
+const struct subst_stats *subst_get_stats(void)
+{
+	return &stats;
+}
@@ -0,0 +1,31 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _SUBST_H
+#define _SUBST_H
+
+#include "../util/parser/parser.h"
+#include "expand.h"
+
+/*
+ * Command substitution: the output of the command of a $(...) part is
+ * written at the end of the expansion buffer, and its trailing new lines
+ * are dropped by shortening the buffer. A lone echo, printf, pwd or test
+ * with no redirection runs in the shell with stdout writing right into
+ * the buffer; anything else runs as with start_command, its output read
+ * from a pipe straight into the buffer.
+ */
+
+struct subst_stats {
+	unsigned long in_process;
+	unsigned long forked;
+	unsigned long bytes;
+};
+
+/**
+ * Run the command and append its output to e.
+ */
+void substitute(struct expansion *e, command_t *c);
+
+const struct subst_stats *subst_get_stats(void);
+
+#endif /* _SUBST_H */
@@ -0,0 +1,137 @@
+#!/bin/sh
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Regression checks: each case feeds a script to mini-shell on stdin and
+# compares what it prints with the expected output. A case may set
+# variables for the shell and pause in the middle of its input, so that
+# commands run while others are still going.
+#
+# Usage: tests/test_shell.sh [SHELL]
+
+SH=${1:-./mini-shell}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+failed=0
+
+# check NAME EXPECTED: compares the output of the shell run by the
+# caller, given on stdin without its prompts, with EXPECTED.
+check() {
+	out=$(sed 's/^\(> \)*//; /^$/d')
+	if [ "$out" = "$2" ]; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1"
+		printf '  expected: %s\n  got:      %s\n' "$2" "$out"
+		failed=1
+	fi
+}
+
+# A queued job whose words hold $(...) starts from the callback of a job
+# that ended, inside the reaper's event loop, and waits there for the
+# substitution's child while other jobs exit.
+(printf 'sleep 0.2 &\nsleep 0.2 &\n/bin/echo $(sleep 0.3)queued &\n'
+	sleep 0.8
+	printf 'wait\necho done\n') |
+	MINISHELL_JOBS=2 $SH 2>&1 | check queued-substitution "queued
+done"
+
+# Pipelines run all their stages at once; the status is the last one's,
+# or with MINISHELL_PIPEFAIL the last failing one's.
+$SH <<'EOF' 2>&1 | check pipeline-stages "c
+2
+100000"
+printf "a\nb\nc\n" | /bin/cat | sort -r | head -1
+/bin/echo x | /bin/cat | cat | /bin/cat | cat | /bin/cat | cat | /bin/cat | wc -c
+seq 1 100000 | /bin/cat | tail -1
+EOF
+$SH <<'EOF' 2>&1 | check pipeline-status "last-ok
+last-failed
+pipefail"
+false | true && echo last-ok
+true | false || echo last-failed
+MINISHELL_PIPEFAIL=1
+false | true || echo pipefail
+EOF
+
+# Here-documents and here-strings: small ones go through a memfd, those
+# over 16 MB through a pipe fed by a thread.
+$SH <<'EOF' 2>&1 | check here-small "a hi
+b \$Y
+c hi
+HI"
+Y=hi
+cat <<END
+a $Y
+END
+cat <<'END'
+b $Y
+END
+cat <<< "c $Y"
+tr a-z A-Z <<< $Y
+EOF
+line=$(printf '%059d' 0 | tr 0 a)
+{ echo 'wc -c <<END'; yes "$line" | head -n 300000; echo END; echo 'echo after'; } \
+	> "$DIR/here.sh"
+$SH "$DIR/here.sh" 2>&1 | check here-pipe "18000000
+after"
+
+# $(...) nests and drops the trailing new lines; echo, printf and pwd
+# alone are captured in the shell, other commands run in a child.
+$SH <<'EOF' 2>&1 | check substitution "[a b]
+<x>
+in quotes ext
+empty"
+echo [$(echo a $(echo b))]
+X=$(printf 'x\n\n\n')
+echo "<$X>"
+echo "$(echo "in quotes") $(/bin/echo ext)"
+echo $(true)empty
+EOF
+printf 'echo $(echo a)\necho $(printf b)$(pwd)\necho $(/bin/echo c)\n' |
+	MINISHELL_STATS=1 $SH 2>&1 > /dev/null | grep substitutions |
+	sed 's/, [0-9]* bytes//' |
+	check substitution-in-process "substitutions: 3 in process, 1 forked"
+
+# A queued job runs with the variables and the directory of the shell
+# when it was submitted, not when its slot frees up.
+printf 'F=one\n/bin/sleep 0.3 &\n/bin/echo $F &\nF=two\n/bin/echo $F &\nwait\n' |
+	MINISHELL_JOBS=1 $SH 2>&1 | check queued-variables "one
+two"
+printf 'cd /tmp\n/bin/sleep 0.3 &\n/bin/pwd &\ncd /\nwait\n' |
+	MINISHELL_JOBS=1 $SH 2>&1 | check queued-directory "/tmp"
+
+# cat takes no option but -u in the shell, the others go to /bin/cat.
+printf 'printf "a\\nb\\n" | cat -n | cat\n' | $SH 2>&1 |
+	check cat-option "     1	a
+     2	b"
+printf 'printf "a\\n" | cat -u - | cat -A\n' | $SH 2>&1 |
+	check cat-option-last "a$"
+
+# A job forked while a cat thread runs must not keep the thread's pipe
+# end, or wc would see its EOF only once the job is over.
+(printf 'sleep 0.1 &\nsleep 1 && echo job &\n'
+	printf '/bin/sleep 0.3 | cat | wc -c\necho piped\n'
+	sleep 1.5
+	printf 'wait\n') |
+	MINISHELL_JOBS=1 $SH 2>&1 | check cat-thread-fds "0
+piped
+job"
+
+# A builtin writing to a reader that went away fails, it does not kill
+# the shell with SIGPIPE.
+head -c 1048576 /dev/zero > "$DIR/big"
+printf 'cat %s\necho more\n/bin/echo after > /dev/stderr\n' "$DIR/big" \
+	> "$DIR/sigpipe.sh"
+{ $SH "$DIR/sigpipe.sh" | head -c 1 > /dev/null; } 2>&1 |
+	check builtin-sigpipe "after"
+
+# An executable file without #! runs with /bin/sh, as with execvp, in
+# every launcher.
+printf 'echo script "$@"\n' > "$DIR/script"
+chmod +x "$DIR/script"
+for method in spawn fork zygote; do
+	printf '%s a b\n' "$DIR/script" | MINISHELL_LAUNCH=$method $SH 2>&1 |
+		check "enoexec-$method" "script a b"
+done
+
+exit $failed
@@ -5,7 +5,6 @@
 
 #include "../util/parser/parser.h"
 
-
 /* Useful macro for handling error codes. */
 #define DIE(assertion, call_description)			\
 	do {							\
@@ -17,15 +16,12 @@
 		}						\
 	} while (0)
 
-/**
- * Concatenate parts of the word to obtain the command.
- */
-char *get_word(word_t *s);
+#define PARSE_ERROR_SIZE	128
 
-/**
- * Concatenate command arguments in a NULL terminated list in order to pass
- * them directly to execv.
+/*
+ * Set by the threads that parse ahead of execution: parse errors are
+ * written there, to be reported when the line is executed.
  */
-char **get_argv(simple_command_t *command, int *size);
+extern __thread char *deferred_parse_error;
 
 #endif /* _UTILS_H */
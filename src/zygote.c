@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/* pipe2, CLONE_PARENT, O_PATH */
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cmd.h"
+#include "launch.h"
+#include "zygote.h"
+
+/* Standard input, output, error and the working directory. */
+#define ZYGOTE_FDS	4
+
+/*
+ * A request is this header, sent with the descriptors, followed by size
+ * bytes of null terminated strings: the file, the argc arguments and the
+ * envc environment entries.
+ */
+struct zygote_request {
+	uint32_t argc;
+	uint32_t envc;
+	uint32_t size;
+};
+
+struct zygote_reply {
+	pid_t pid;
+	int err;
+};
+
+static struct {
+	int sock;
+	pid_t owner;
+} zygote = { -1, -1 };
+
+static bool read_full(int fd, void *buffer, size_t size)
+{
+	char *p = buffer;
+	ssize_t n;
+
+	while (size > 0) {
+		n = read(fd, p, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+static bool send_full(int fd, const void *buffer, size_t size)
+{
+	const char *p = buffer;
+	ssize_t n;
+
+	while (size > 0) {
+		n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+/**
+ * The command, in the new child: failing to exec is written to the
+ * error pipe, whose end is closed on a successful exec.
+ */
+static void zygote_exec(const char *path, char **argv, char **envp,
+		const int fds[ZYGOTE_FDS], int error_pipe)
+{
+	sigset_t mask;
+	int i, err;
+
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	for (i = 0; i < 3; i++)
+		if (dup2(fds[i], i) < 0)
+			goto fail;
+	if (fchdir(fds[3]) < 0)
+		goto fail;
+
+	launch_exec(path, argv, envp);
+
+fail:
+	err = errno;
+	write(error_pipe, &err, sizeof(err));
+	_exit(FAILURE_CODE);
+}
+
+/**
+ * Receive a request; false when the shell is gone.
+ */
+static bool receive_request(int sock, struct zygote_request *request,
+		int fds[ZYGOTE_FDS])
+{
+	char control[CMSG_SPACE(ZYGOTE_FDS * sizeof(int))];
+	struct iovec iov = { request, sizeof(*request) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	ssize_t n;
+
+	do {
+		n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	} while (n < 0 && errno == EINTR);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (n <= 0 || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+		cmsg->cmsg_len != CMSG_LEN(ZYGOTE_FDS * sizeof(int)))
+		return false;
+	memcpy(fds, CMSG_DATA(cmsg), ZYGOTE_FDS * sizeof(int));
+
+	/* The descriptors came with the first bytes of the header. */
+	return read_full(sock, (char *)request + n, sizeof(*request) - n);
+}
+
+static struct zygote_reply zygote_serve(int sock, struct zygote_request *r,
+		const int fds[ZYGOTE_FDS])
+{
+	struct zygote_reply reply = { -1, 0 };
+	char *strings = malloc(r->size + 1);
+	char **argv = malloc((r->argc + r->envc + 2) * sizeof(*argv));
+	char **envp, *p;
+	int error_pipe[2];
+	uint32_t i;
+
+	if (strings == NULL || argv == NULL) {
+		reply.err = ENOMEM;
+		goto out;
+	}
+	if (!read_full(sock, strings, r->size))
+		_exit(FAILURE_CODE);
+	strings[r->size] = '\0';
+
+	p = strings + strlen(strings) + 1;
+	envp = argv + r->argc + 1;
+	for (i = 0; i < r->argc; i++, p += strlen(p) + 1)
+		argv[i] = p;
+	argv[r->argc] = NULL;
+	for (i = 0; i < r->envc; i++, p += strlen(p) + 1)
+		envp[i] = p;
+	envp[r->envc] = NULL;
+
+	if (pipe2(error_pipe, O_CLOEXEC) < 0) {
+		reply.err = errno;
+		goto out;
+	}
+
+	/* Like fork, but the child's parent is the shell. */
+	reply.pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL,
+		NULL, 0);
+	if (reply.pid == 0)
+		zygote_exec(strings, argv, envp, fds, error_pipe[1]);
+	if (reply.pid < 0)
+		reply.err = errno;
+
+	/* End of file on the error pipe: the exec succeeded. */
+	close(error_pipe[1]);
+	if (reply.pid > 0 && !read_full(error_pipe[0], &reply.err,
+		sizeof(reply.err)))
+		reply.err = 0;
+	close(error_pipe[0]);
+
+out:
+	free(argv);
+	free(strings);
+
+	return reply;
+}
+
+static void zygote_main(int sock)
+{
+	struct zygote_request request;
+	struct zygote_reply reply;
+	int fds[ZYGOTE_FDS], i;
+
+	for (;;) {
+		if (!receive_request(sock, &request, fds))
+			_exit(SUCCESS_CODE);
+
+		reply = zygote_serve(sock, &request, fds);
+		for (i = 0; i < ZYGOTE_FDS; i++)
+			close(fds[i]);
+
+		if (!send_full(sock, &reply, sizeof(reply)))
+			_exit(SUCCESS_CODE);
+	}
+}
+
+bool zygote_start(void)
+{
+	int sv[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		return false;
+
+	pid = fork();
+	if (pid < 0) {
+		close(sv[0]);
+		close(sv[1]);
+		return false;
+	}
+
+	if (pid == 0) {
+		close(sv[0]);
+		zygote_main(sv[1]);
+	}
+
+	close(sv[1]);
+	zygote.sock = sv[0];
+	zygote.owner = getpid();
+
+	return true;
+}
+
+bool zygote_usable(void)
+{
+	return zygote.sock >= 0 && zygote.owner == getpid();
+}
+
+/**
+ * A zygote that stopped answering is not used again.
+ */
+static pid_t zygote_lost(void)
+{
+	close(zygote.sock);
+	zygote.sock = -1;
+	errno = EAGAIN;
+
+	return -1;
+}
+
+pid_t zygote_launch(const char *path, char *const argv[],
+		char *const envp[], const int fds[3])
+{
+	char control[CMSG_SPACE(ZYGOTE_FDS * sizeof(int))];
+	struct zygote_request request = { 0, 0, 0 };
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control,
+		.msg_controllen = sizeof(control),
+	};
+	struct cmsghdr *cmsg;
+	struct zygote_reply reply;
+	int sent[ZYGOTE_FDS], i;
+	char *buffer, *p;
+	size_t length;
+	ssize_t n;
+
+	request.size = strlen(path) + 1;
+	for (; argv[request.argc] != NULL; request.argc++)
+		request.size += strlen(argv[request.argc]) + 1;
+	for (; envp[request.envc] != NULL; request.envc++)
+		request.size += strlen(envp[request.envc]) + 1;
+
+	length = sizeof(request) + request.size;
+	buffer = malloc(length);
+	if (buffer == NULL)
+		return -1;
+	memcpy(buffer, &request, sizeof(request));
+	p = stpcpy(buffer + sizeof(request), path) + 1;
+	for (i = 0; argv[i] != NULL; i++)
+		p = stpcpy(p, argv[i]) + 1;
+	for (i = 0; envp[i] != NULL; i++)
+		p = stpcpy(p, envp[i]) + 1;
+
+	/* The streams left alone are the shell's current ones. */
+	for (i = 0; i < 3; i++)
+		sent[i] = fds[i] >= 0 ? fds[i] : i;
+	sent[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (sent[3] < 0) {
+		free(buffer);
+		return -1;
+	}
+
+	memset(control, 0, sizeof(control));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(sent));
+	memcpy(CMSG_DATA(cmsg), sent, sizeof(sent));
+	iov.iov_base = buffer;
+	iov.iov_len = length;
+
+	do {
+		n = sendmsg(zygote.sock, &msg, MSG_NOSIGNAL);
+	} while (n < 0 && errno == EINTR);
+	close(sent[3]);
+
+	/* A large environment may take more than one write. */
+	if (n >= 0 && (size_t)n < length &&
+		!send_full(zygote.sock, buffer + n, length - n))
+		n = -1;
+	free(buffer);
+
+	if (n < 0 || !read_full(zygote.sock, &reply, sizeof(reply)))
+		return zygote_lost();
+
+	if (reply.err != 0) {
+		/* The child that failed to exec is the shell's to reap. */
+		if (reply.pid > 0)
+			waitpid(reply.pid, NULL, 0);
+		errno = reply.err;
+		return -1;
+	}
+
+	return reply.pid;
+}
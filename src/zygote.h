@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef _ZYGOTE_H
+#define _ZYGOTE_H
+
+#include <sys/types.h>
+
+#include "../util/parser/parser.h"
+
+/*
+ * Zygote: a helper forked when the shell starts, while its memory is
+ * still small. The shell sends it each command to run (file, argv, the
+ * environment, and the standard streams and the working directory as
+ * descriptors passed with SCM_RIGHTS) over a socketpair; the zygote
+ * starts it with clone(CLONE_PARENT), so the command is a child of the
+ * shell, and replies with its pid. The fork is paid by the zygote,
+ * whose size does not change, however large the shell grows.
+ */
+
+/**
+ * Fork the zygote; false if it could not be started.
+ */
+bool zygote_start(void);
+
+/**
+ * Whether this process can use the zygote: forked children of the
+ * shell cannot, the commands would not be their children.
+ */
+bool zygote_usable(void);
+
+/**
+ * Same contract as launch_command.
+ */
+pid_t zygote_launch(const char *path, char *const argv[],
+		char *const envp[], const int fds[3]);
+
+#endif /* _ZYGOTE_H */
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Binary image round trip: parses every line of the given files (or of
+ * stdin), writes all the trees to an AST image file, loads it back and
+ * checks that every loaded tree matches the tree the parser builds for
+ * the same line (words, operators, redirections, shared words and up
+ * pointers).
+ *
+ * Lines that fail to parse (see tests/negative_tests.txt) are counted
+ * and stored as empty lines.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./parser.h"
+#include "./ast_image.h"
+
+struct lines {
+	char **line;
+	size_t *length;
+	size_t count;
+	size_t capacity;
+};
+
+static unsigned long parse_errors;
+
+
+void parse_error(const char *str, const int where)
+{
+	/* Negative tests are expected to fail; keep the output clean. */
+	(void)str;
+	(void)where;
+	parse_errors++;
+}
+
+
+static void add_line(struct lines *lines, const char *line, size_t length)
+{
+	if (lines->count == lines->capacity) {
+		lines->capacity = lines->capacity ? 2 * lines->capacity : 64;
+		lines->line = realloc(lines->line,
+			lines->capacity * sizeof(*lines->line));
+		lines->length = realloc(lines->length,
+			lines->capacity * sizeof(*lines->length));
+		if (lines->line == NULL || lines->length == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	lines->line[lines->count] = malloc(length + 1);
+	if (lines->line[lines->count] == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(lines->line[lines->count], line, length);
+	lines->length[lines->count++] = length;
+}
+
+
+static void load_lines(struct lines *lines, FILE *file)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+
+	while ((length = getline(&line, &size, file)) >= 0) {
+		if (length > 0 && line[length - 1] == '\n')
+			length--;
+		add_line(lines, line, length);
+	}
+
+	free(line);
+}
+
+
+static int same_command(const command_t *a, const command_t *b,
+		const command_t *up);
+
+
+static int same_word(const word_t *a, const word_t *b)
+{
+	for (; a != NULL && b != NULL; a = a->next_part, b = b->next_part)
+		if (a->length != b->length || a->expand != b->expand ||
+			memcmp(a->string, b->string, a->length) != 0 ||
+			!same_command(a->command, b->command, NULL))
+			return 0;
+
+	return a == NULL && b == NULL;
+}
+
+
+static int same_list(const word_t *a, const word_t *b)
+{
+	for (; a != NULL && b != NULL; a = a->next_word, b = b->next_word)
+		if (!same_word(a, b))
+			return 0;
+
+	return a == NULL && b == NULL;
+}
+
+
+/*
+ * Words entered as "&> name" are in both the out and the err list, the
+ * loaded tree must share the same words
+ */
+static int same_sharing(const simple_command_t *a, const simple_command_t *b)
+{
+	const word_t *ao, *ae, *bo, *be;
+
+	for (ao = a->out, bo = b->out; ao != NULL; ao = ao->next_word, bo = bo->next_word)
+		for (ae = a->err, be = b->err; ae != NULL; ae = ae->next_word, be = be->next_word)
+			if ((ao == ae) != (bo == be))
+				return 0;
+
+	return 1;
+}
+
+
+static int same_command(const command_t *a, const command_t *b,
+		const command_t *up)
+{
+	if (a == NULL || b == NULL)
+		return a == NULL && b == NULL;
+
+	if (a->op != b->op || b->up != up || b->aux != NULL)
+		return 0;
+
+	if (a->scmd != NULL || b->scmd != NULL) {
+		if (a->scmd == NULL || b->scmd == NULL)
+			return 0;
+		if (b->scmd->up != b || b->scmd->aux != NULL ||
+			a->scmd->io_flags != b->scmd->io_flags ||
+			!same_word(a->scmd->verb, b->scmd->verb) ||
+			(b->scmd->verb && b->scmd->verb->next_word != NULL) ||
+			!same_list(a->scmd->params, b->scmd->params) ||
+			!same_list(a->scmd->in, b->scmd->in) ||
+			!same_list(a->scmd->out, b->scmd->out) ||
+			!same_list(a->scmd->err, b->scmd->err) ||
+			!same_word(a->scmd->here, b->scmd->here) ||
+			!same_sharing(a->scmd, b->scmd))
+			return 0;
+	}
+
+	return same_command(a->cmd1, b->cmd1, b) &&
+		same_command(a->cmd2, b->cmd2, b);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct lines lines = { NULL, NULL, 0, 0 };
+	char path[] = "/tmp/ast_image_XXXXXX";
+	struct ast_writer *writer;
+	struct ast_image *image;
+	parser_ctx_t *ctx;
+	command_t *root;
+	unsigned long errors, mismatches = 0, trees = 0;
+	size_t size, i;
+	void *data;
+	FILE *file;
+	int fd, arg;
+
+	if (argc == 1)
+		load_lines(&lines, stdin);
+	for (arg = 1; arg < argc; arg++) {
+		file = fopen(argv[arg], "r");
+		if (file == NULL) {
+			perror(argv[arg]);
+			return EXIT_FAILURE;
+		}
+		load_lines(&lines, file);
+		fclose(file);
+	}
+
+	ctx = parser_ctx_create();
+	writer = ast_writer_create();
+	if (ctx == NULL || writer == NULL) {
+		fprintf(stderr, "Error creating the parser context or the writer\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < lines.count; i++) {
+		root = NULL;
+		if (!parse_line_r(ctx, lines.line[i], lines.length[i], &root))
+			root = NULL;
+		trees += root != NULL;
+		ast_writer_add(writer, root);
+	}
+	errors = parse_errors;
+
+	data = ast_writer_finish(writer, &size);
+	fd = mkstemp(path);
+	if (fd < 0 || write(fd, data, size) != (ssize_t)size) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	close(fd);
+	free(data);
+
+	image = ast_image_load(path);
+	unlink(path);
+	if (image == NULL || ast_image_count(image) != lines.count) {
+		fprintf(stderr, "Error loading the AST image\n");
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < lines.count; i++) {
+		root = NULL;
+		if (!parse_line_r(ctx, lines.line[i], lines.length[i], &root))
+			root = NULL;
+		if (!same_command(root, ast_image_root(image, i), NULL)) {
+			printf("line %zu differs: %.*s\n", i + 1,
+				(int)lines.length[i], lines.line[i]);
+			mismatches++;
+		}
+	}
+
+	printf("%zu lines, %lu trees, %lu parse errors, %zu bytes: %s\n",
+		lines.count, trees, errors, size, mismatches ? "FAILED" : "OK");
+
+	ast_image_close(image);
+	parser_ctx_destroy(ctx);
+	for (i = 0; i < lines.count; i++)
+		free(lines.line[i]);
+	free(lines.line);
+	free(lines.length);
+
+	return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,414 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Parser benchmark: parses every line of the given files (or of stdin)
+ * and reports the parse rate (lines/s and MB/s), how many heap
+ * allocations the parser and the lexer made per line and the peak RSS
+ * of the process.
+ *
+ * With -g KIND N it parses a synthetic command line made of N elements:
+ * arguments (args), pipeline stages (pipe), && operands (and) or quoted
+ * multi-part words (quote); the time per element should not grow with
+ * N. -p N is the same as -g args N.
+ *
+ * With -s DIR it runs the whole suite: the corpora in DIR (the tests
+ * directory) and every generator at a few sizes.
+ *
+ * With -t N the lines of all the files are parsed concurrently by N
+ * threads, each one with its own parser context.
+ *
+ * Allocations are counted by linking with
+ *   -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=strdup
+ * (see the bench-parser target in the Makefile).
+ */
+
+#include <sys/resource.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "./parser.h"
+
+#define DEFAULT_ROUNDS	100
+#define MAX_THREADS	256
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+
+static unsigned long alloc_count;
+
+
+void *__wrap_malloc(size_t size)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_malloc(size);
+}
+
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_calloc(nmemb, size);
+}
+
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_realloc(ptr, size);
+}
+
+
+char *__wrap_strdup(const char *str)
+{
+	__atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+	return __real_strdup(str);
+}
+
+
+void parse_error(const char *str, const int where)
+{
+	/* Negative tests are expected to fail; keep the output clean. */
+	(void)str;
+	(void)where;
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static long peak_rss_kb(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+
+static void bench_file(FILE *in, const char *name, int rounds)
+{
+	char *line = NULL;
+	size_t line_size = 0;
+	unsigned long lines = 0, failed = 0, allocs;
+	double start, elapsed = 0, bytes = 0;
+	int i;
+
+	alloc_count = 0;
+
+	while (getline(&line, &line_size, in) != -1) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		start = now();
+		for (i = 0; i < rounds; i++) {
+			command_t *root = NULL;
+
+			if (!parse_line(line, &root))
+				failed++;
+			free_parse_memory();
+		}
+		elapsed += now() - start;
+		bytes += strlen(line);
+		lines++;
+	}
+
+	/* getline() itself is not wrapped, it lives in libc. */
+	allocs = alloc_count;
+	free(line);
+
+	if (lines == 0)
+		return;
+
+	printf("%-24s %6lu lines %6lu errors %8.2f allocs/line %10.0f lines/s %8.2f MB/s %8ld KB RSS\n",
+		name, lines, failed / rounds,
+		(double)allocs / (lines * rounds),
+		elapsed > 0 ? lines * rounds / elapsed : 0,
+		elapsed > 0 ? bytes * rounds / elapsed / 1e6 : 0,
+		peak_rss_kb());
+}
+
+
+/*
+ * Synthetic lines: a head followed by count elements, each one printed
+ * from a format that takes the element index (twice)
+ */
+
+struct generator {
+	const char *name;
+	const char *head;
+	const char *element;
+};
+
+static const struct generator generators[] = {
+	/* tar cf out.tar file0 dir1/$VAR ... */
+	{ "args",  "tar cf out.tar", " file%lu dir%lu/$VAR" },
+	/* cat in | grep -v x0 | sed s/a/b/ | ... */
+	{ "pipe",  "cat in",         " | grep -v x%lu | sed s/a%lu/b/" },
+	/* true && test -f f0 && mkdir d0 && ... */
+	{ "and",   "true",           " && test -f f%lu && mkdir d%lu" },
+	/* echo "a b $V0 c"'single 0'x ... */
+	{ "quote", "echo",           " \"a b $V%lu c\"'single %lu'x" },
+};
+
+#define NR_GENERATORS	(sizeof(generators) / sizeof(generators[0]))
+
+
+static const struct generator *find_generator(const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < NR_GENERATORS; i++)
+		if (strcmp(generators[i].name, name) == 0)
+			return &generators[i];
+
+	return NULL;
+}
+
+
+static void bench_generated(const struct generator *gen, unsigned long count)
+{
+	size_t line_size = strlen(gen->head) + 1 +
+		count * (strlen(gen->element) + 2 * 20);
+	char *line = malloc(line_size);
+	size_t line_length;
+	unsigned long i, rounds;
+	double start, elapsed;
+
+	if (line == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	line_length = sprintf(line, "%s", gen->head);
+	for (i = 0; i < count; i++)
+		line_length += sprintf(line + line_length, gen->element,
+			2 * i, 2 * i + 1);
+
+	/* Keep the total amount of work roughly constant. */
+	rounds = count < 1000000 ? 1000000 / count : 1;
+
+	alloc_count = 0;
+	start = now();
+	for (i = 0; i < rounds; i++) {
+		command_t *root = NULL;
+
+		if (!parse_line(line, &root)) {
+			fprintf(stderr, "Error parsing the synthetic line!\n");
+			exit(EXIT_FAILURE);
+		}
+		free_parse_memory();
+	}
+	elapsed = now() - start;
+
+	printf("%-6s %8lu elements %10.3f ms/line %8.1f ns/element %8.2f allocs/line %8.2f MB/s %8ld KB RSS\n",
+		gen->name, count, elapsed * 1e3 / rounds,
+		elapsed * 1e9 / ((double)rounds * count),
+		(double)alloc_count / rounds,
+		line_length * (double)rounds / elapsed / 1e6,
+		peak_rss_kb());
+
+	free(line);
+}
+
+
+/*
+ * The whole suite: the corpora in tests/ and every generator at a few
+ * sizes
+ */
+static int bench_suite(const char *dir, int rounds)
+{
+	static const char * const corpora[] = {
+		"small_tests.txt", "ugly_tests.txt", "negative_tests.txt"
+	};
+	static const unsigned long sizes[] = { 10, 1000, 100000 };
+	char path[4096];
+	FILE *in;
+	size_t i, j;
+
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, corpora[i]);
+		in = fopen(path, "r");
+		if (in == NULL) {
+			perror(path);
+			return EXIT_FAILURE;
+		}
+		bench_file(in, corpora[i], rounds);
+		fclose(in);
+	}
+
+	for (i = 0; i < NR_GENERATORS; i++)
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++)
+			bench_generated(&generators[i], sizes[j]);
+
+	return EXIT_SUCCESS;
+}
+
+
+struct corpus {
+	char **lines;
+	size_t *lengths;
+	size_t count;
+	size_t bytes;
+	int rounds;
+};
+
+
+static void load_corpus(struct corpus *corpus, const char *name)
+{
+	FILE *in = fopen(name, "r");
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t length;
+
+	if (in == NULL) {
+		perror(name);
+		exit(EXIT_FAILURE);
+	}
+
+	while ((length = getline(&line, &line_size, in)) != -1) {
+		corpus->lines = realloc(corpus->lines,
+			(corpus->count + 1) * sizeof(*corpus->lines));
+		corpus->lengths = realloc(corpus->lengths,
+			(corpus->count + 1) * sizeof(*corpus->lengths));
+		if (corpus->lines == NULL || corpus->lengths == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+
+		corpus->lengths[corpus->count] = strcspn(line, "\r\n");
+		corpus->lines[corpus->count] = line;
+		corpus->bytes += corpus->lengths[corpus->count];
+		corpus->count++;
+
+		line = NULL;
+		line_size = 0;
+	}
+
+	free(line);
+	fclose(in);
+}
+
+
+static void *parse_corpus(void *arg)
+{
+	struct corpus *corpus = arg;
+	parser_ctx_t *ctx = parser_ctx_create();
+	size_t i;
+	int round;
+
+	for (round = 0; round < corpus->rounds; round++)
+		for (i = 0; i < corpus->count; i++) {
+			command_t *root = NULL;
+
+			parse_line_r(ctx, corpus->lines[i], corpus->lengths[i], &root);
+		}
+
+	parser_ctx_destroy(ctx);
+
+	return NULL;
+}
+
+
+static void bench_threads(struct corpus *corpus, int threads)
+{
+	pthread_t tids[MAX_THREADS];
+	double start, elapsed;
+	double lines;
+	int i;
+
+	start = now();
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tids[i], NULL, parse_corpus, corpus) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+	elapsed = now() - start;
+
+	lines = (double)corpus->count * corpus->rounds * threads;
+	printf("%3d threads %8zu lines %12.0f lines/s %10.2f MB/s\n",
+		threads, corpus->count, lines / elapsed,
+		corpus->bytes * (lines / corpus->count) / elapsed / 1e6);
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct corpus corpus;
+	int rounds = DEFAULT_ROUNDS;
+	int threads = 0;
+	int files = 0, synthetic = 0;
+	int i;
+
+	memset(&corpus, 0, sizeof(corpus));
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			rounds = atoi(argv[++i]);
+			if (rounds <= 0)
+				rounds = DEFAULT_ROUNDS;
+		} else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+			if (threads <= 0 || threads > MAX_THREADS)
+				threads = 1;
+		} else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+			unsigned long params = strtoul(argv[++i], NULL, 10);
+
+			if (params > 0)
+				bench_generated(find_generator("args"), params);
+			synthetic++;
+		} else if (strcmp(argv[i], "-g") == 0 && i + 2 < argc) {
+			const struct generator *gen = find_generator(argv[++i]);
+			unsigned long count = strtoul(argv[++i], NULL, 10);
+
+			if (gen == NULL) {
+				fprintf(stderr, "Unknown generator %s\n", argv[i - 1]);
+				return EXIT_FAILURE;
+			}
+			if (count > 0)
+				bench_generated(gen, count);
+			synthetic++;
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			if (bench_suite(argv[++i], rounds) != EXIT_SUCCESS)
+				return EXIT_FAILURE;
+			synthetic++;
+		} else if (threads > 0) {
+			load_corpus(&corpus, argv[i]);
+			files++;
+		} else {
+			FILE *in = fopen(argv[i], "r");
+
+			if (in == NULL) {
+				perror(argv[i]);
+				return EXIT_FAILURE;
+			}
+
+			bench_file(in, argv[i], rounds);
+			fclose(in);
+			files++;
+		}
+	}
+
+	if (threads > 0 && corpus.count > 0) {
+		corpus.rounds = rounds;
+		bench_threads(&corpus, threads);
+	}
+
+	if (files == 0 && synthetic == 0)
+		bench_file(stdin, "<stdin>", rounds);
+
+	return EXIT_SUCCESS;
+}
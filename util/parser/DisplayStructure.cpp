@@ -27,8 +27,10 @@ static void displayWord(word_t * w)
 	while (crt != NULL) {
 		if (crt->expand)
 			std::cout << "expand(";
-		std::cout << "'" << crt->string << "'";
-		if (crt->expand)
+		if (crt->command != NULL)
+			std::cout << "command(";
+		std::cout << "'" << std::string(crt->string, crt->length) << "'";
+		if (crt->expand || (crt->command != NULL))
 			std::cout << ")";
 
 		crt = crt->next_part;
@@ -95,6 +97,15 @@ static void displaySimple(simple_command_t * s, int level, command_t * father)
 		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
 	}
 
+	if (s->io_flags & (IO_HERE_STRING | IO_HERE_DOC)) {
+		std::cout << std::setw(2 * indent * level + indent) << "" << "here (" << std::endl;
+		if (s->here != NULL)
+			displayList(s->here, level + 1);
+		if (s->io_flags & IO_HERE_DOC)
+			std::cout << std::setw(2 * indent * (level+1)) << "" << "DOCUMENT" << std::endl;
+		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+	}
+
 	std::cout << std::setw(2 * indent * level) << "" << ")" << std::endl;
 }
 
@@ -139,9 +150,11 @@ static void displayCommand(command_t * c, int level, command_t * father)
 		std::cout << std::setw(2 * indent * level + indent) << "" << "cmd1 (" << std::endl;
 		displayCommand(c->cmd1, level + 1, c);
 		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
-		std::cout << std::setw(2 * indent * level + indent) << "" << "cmd2 (" << std::endl;
-		displayCommand(c->cmd2, level + 1, c);
-		std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+		if (c->cmd2 != NULL) {
+			std::cout << std::setw(2 * indent * level + indent) << "" << "cmd2 (" << std::endl;
+			displayCommand(c->cmd2, level + 1, c);
+			std::cout << std::setw(2 * indent * level + indent) << "" << ")" << std::endl;
+		}
 	}
 
 	std::cout << std::setw(2 * indent * level) << "" << ")" << std::endl;
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+/*
+ * Lexer token dump: prints every token the lexer returns for each line
+ * of the given files (or of stdin), with its location and its value, so
+ * the token streams of the flex lexer (parser.l) and of the hand-written
+ * one (hand_lexer.c) can be compared (see the lexer-check target in the
+ * Makefile).
+ *
+ * With -b ROUNDS it only runs the lexer over all the lines ROUNDS times
+ * and reports the token and byte rates (see the lexer-bench target).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define __PARSER_H_INTERNAL_INCLUDE
+#include "./parser.h"
+#include "./parser.tab.h"
+
+int yylex(YYSTYPE *lvalp, YYLTYPE *llocp, void *scanner);
+
+struct lines {
+	char **line;
+	size_t *length;
+	size_t count;
+	size_t bytes;
+};
+
+
+static const char *token_name(int token)
+{
+	switch (token) {
+	case NOT_ACCEPTED_CHAR:		return "NOT_ACCEPTED_CHAR";
+	case INVALID_ENVIRONMENT_VAR:	return "INVALID_ENVIRONMENT_VAR";
+	case UNEXPECTED_EOF:		return "UNEXPECTED_EOF";
+	case CHARS_AFTER_EOL:		return "CHARS_AFTER_EOL";
+	case END_OF_FILE:		return "END_OF_FILE";
+	case END_OF_LINE:		return "END_OF_LINE";
+	case BLANK:			return "BLANK";
+	case REDIRECT_OE:		return "REDIRECT_OE";
+	case REDIRECT_O:		return "REDIRECT_O";
+	case REDIRECT_E:		return "REDIRECT_E";
+	case INDIRECT:			return "INDIRECT";
+	case HERE_DOC:			return "HERE_DOC";
+	case HERE_STRING:		return "HERE_STRING";
+	case REDIRECT_APPEND_E:		return "REDIRECT_APPEND_E";
+	case REDIRECT_APPEND_O:		return "REDIRECT_APPEND_O";
+	case WORD:			return "WORD";
+	case ENV_VAR:			return "ENV_VAR";
+	case COMMAND_SUBSTITUTION:	return "COMMAND_SUBSTITUTION";
+	case SEQUENTIAL:		return "SEQUENTIAL";
+	case PARALLEL:			return "PARALLEL";
+	case CONDITIONAL_NZERO:		return "CONDITIONAL_NZERO";
+	case CONDITIONAL_ZERO:		return "CONDITIONAL_ZERO";
+	case PIPE:			return "PIPE";
+	default:			return "UNKNOWN";
+	}
+}
+
+
+static void load_lines(struct lines *lines, FILE *file)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+
+	/* The new lines are kept, as in the lines given to parse_line. */
+	while ((length = getline(&line, &size, file)) >= 0) {
+		lines->line = realloc(lines->line,
+			(lines->count + 1) * sizeof(*lines->line));
+		lines->length = realloc(lines->length,
+			(lines->count + 1) * sizeof(*lines->length));
+		if (lines->line == NULL || lines->length == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+
+		/* getline leaves room for the second '\0' the lexer needs. */
+		line = realloc(line, length + 2);
+		if (line == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		line[length] = line[length + 1] = '\0';
+
+		lines->line[lines->count] = line;
+		lines->length[lines->count++] = length;
+		lines->bytes += length;
+
+		line = NULL;
+		size = 0;
+	}
+
+	free(line);
+}
+
+
+/* Runs the lexer over a line, returns the number of tokens. */
+static unsigned long lex_line(void *scanner, char *line, size_t length,
+		FILE *out)
+{
+	unsigned long tokens = 0;
+	YYSTYPE value;
+	YYLTYPE location;
+	int token;
+
+	memset(&location, 0, sizeof(location));
+	scannerSetBuffer(scanner, line, length + 2);
+
+	do {
+		token = yylex(&value, &location, scanner);
+		tokens++;
+
+		if (out == NULL)
+			continue;
+
+		fprintf(out, "%d-%d %s", location.first_column,
+			location.last_column, token_name(token));
+		if (token == WORD || token == ENV_VAR ||
+			token == COMMAND_SUBSTITUTION)
+			fprintf(out, " [%.*s]", (int)value.string_un.len,
+				value.string_un.str);
+		fputc('\n', out);
+	} while (token != END_OF_FILE && token != UNEXPECTED_EOF);
+
+	scannerEndBuffer(scanner);
+
+	return tokens;
+}
+
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct lines lines = { NULL, NULL, 0, 0 };
+	unsigned long tokens = 0, rounds = 0, round;
+	double start, elapsed;
+	void *scanner;
+	FILE *file;
+	size_t i;
+	int arg = 1;
+
+	if (argc > 2 && strcmp(argv[1], "-b") == 0) {
+		rounds = strtoul(argv[2], NULL, 10);
+		arg = 3;
+	}
+
+	if (arg == argc)
+		load_lines(&lines, stdin);
+	for (; arg < argc; arg++) {
+		file = fopen(argv[arg], "r");
+		if (file == NULL) {
+			perror(argv[arg]);
+			return EXIT_FAILURE;
+		}
+		load_lines(&lines, file);
+		fclose(file);
+	}
+
+	scanner = scannerCreate();
+
+	if (rounds == 0) {
+		for (i = 0; i < lines.count; i++) {
+			printf("> %.*s", (int)lines.length[i], lines.line[i]);
+			if (lines.length[i] == 0 ||
+				lines.line[i][lines.length[i] - 1] != '\n')
+				putchar('\n');
+			lex_line(scanner, lines.line[i], lines.length[i], stdout);
+		}
+	} else {
+		start = now();
+		for (round = 0; round < rounds; round++)
+			for (i = 0; i < lines.count; i++)
+				tokens += lex_line(scanner, lines.line[i],
+					lines.length[i], NULL);
+		elapsed = now() - start;
+
+		printf("%zu lines %12.0f tokens/s %12.0f lines/s %8.2f MB/s\n",
+			lines.count, tokens / elapsed,
+			lines.count * rounds / elapsed,
+			lines.bytes * rounds / elapsed / 1e6);
+	}
+
+	scannerDestroy(scanner);
+	for (i = 0; i < lines.count; i++)
+		free(lines.line[i]);
+	free(lines.line);
+	free(lines.length);
+
+	return EXIT_SUCCESS;
+}
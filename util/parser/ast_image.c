@@ -0,0 +1,706 @@
+// SPDX-License-Identifier: BSD-3-Clause
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./ast_image.h"
+
+#define NODE_ALIGN		8
+#define INITIAL_MAP_SIZE	64
+
+#define ALIGN_UP(x)		(((x) + NODE_ALIGN - 1) & ~(size_t)(NODE_ALIGN - 1))
+#define NODE(w, type, node)	((type *)((w)->nodes.data + (node)))
+
+struct ast_image_header {
+	char magic[8];
+	uint32_t version;
+	uint16_t pointer_size;
+	uint16_t word_size;
+	uint16_t scmd_size;
+	uint16_t command_size;
+	uint32_t reserved;
+	uint64_t nroots;
+	uint64_t nrelocs;
+	uint64_t roots_offset;
+	uint64_t relocs_offset;
+	uint64_t nodes_offset;
+	uint64_t strings_offset;
+	uint64_t size;
+};
+
+/* A growable array of bytes. */
+struct buffer {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+/*
+ * While an image is written, links hold offsets inside the nodes or the
+ * strings; they are made relative to the image once its layout is known.
+ */
+enum area {
+	AREA_NODES,
+	AREA_STRINGS
+};
+
+struct reloc {
+	uint64_t field;
+	uint64_t area;
+};
+
+/*
+ * The words of the current tree that were already written, since a word
+ * can be both in the out and the err list of a command.
+ */
+struct word_map_entry {
+	const word_t *word;
+	size_t node;
+	unsigned long generation;
+};
+
+struct ast_writer {
+	struct buffer nodes;
+	struct buffer strings;
+	struct buffer relocs;
+	struct buffer roots;
+	struct word_map_entry *map;
+	size_t map_capacity;
+	size_t map_count;
+	unsigned long generation;
+};
+
+struct ast_image {
+	char *base;
+	size_t size;
+	bool mapped;
+	const struct ast_image_header *header;
+	const uint64_t *roots;
+};
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (ptr == NULL) {
+		perror("Error allocating AST image");
+		exit(EXIT_FAILURE);
+	}
+
+	return ptr;
+}
+
+/**
+ * Reserve size zeroed bytes at the end of a buffer and return their offset.
+ */
+static size_t buffer_reserve(struct buffer *buf, size_t size)
+{
+	size_t offset = buf->size;
+
+	if (buf->capacity - buf->size < size) {
+		buf->capacity = buf->capacity ? buf->capacity : 256;
+		while (buf->capacity - buf->size < size)
+			buf->capacity *= 2;
+		buf->data = xrealloc(buf->data, buf->capacity);
+	}
+
+	memset(buf->data + offset, 0, size);
+	buf->size += size;
+
+	return offset;
+}
+
+static void buffer_append(struct buffer *buf, const void *data, size_t size)
+{
+	size_t offset;
+
+	if (size == 0)
+		return;
+
+	offset = buffer_reserve(buf, size);
+	memcpy(buf->data + offset, data, size);
+}
+
+static size_t map_slot(struct ast_writer *w, const word_t *word)
+{
+	size_t i = ((uintptr_t)word >> 4) * 0x9e3779b97f4a7c15ULL;
+
+	for (i &= w->map_capacity - 1; ; i = (i + 1) & (w->map_capacity - 1))
+		if (w->map[i].generation != w->generation || w->map[i].word == word)
+			return i;
+}
+
+static bool map_find(struct ast_writer *w, const word_t *word, size_t *node)
+{
+	size_t i = map_slot(w, word);
+
+	if (w->map[i].generation != w->generation)
+		return false;
+
+	*node = w->map[i].node;
+	return true;
+}
+
+static void map_insert(struct ast_writer *w, const word_t *word, size_t node);
+
+/**
+ * Double the map, moving the words of the current tree.
+ */
+static void map_grow(struct ast_writer *w)
+{
+	struct word_map_entry *old = w->map;
+	size_t old_capacity = w->map_capacity;
+	size_t i;
+
+	w->map_capacity *= 2;
+	w->map = calloc(w->map_capacity, sizeof(*w->map));
+	if (w->map == NULL) {
+		perror("Error allocating AST image");
+		exit(EXIT_FAILURE);
+	}
+	w->map_count = 0;
+
+	for (i = 0; i < old_capacity; i++)
+		if (old[i].generation == w->generation)
+			map_insert(w, old[i].word, old[i].node);
+
+	free(old);
+}
+
+static void map_insert(struct ast_writer *w, const word_t *word, size_t node)
+{
+	size_t i;
+
+	if (2 * (w->map_count + 1) > w->map_capacity)
+		map_grow(w);
+
+	i = map_slot(w, word);
+	w->map[i].word = word;
+	w->map[i].node = node;
+	w->map[i].generation = w->generation;
+	w->map_count++;
+}
+
+/**
+ * Store the offset of a node or string in a pointer field of a node and
+ * remember to relocate it.
+ */
+static void set_link(struct ast_writer *w, size_t field, size_t target,
+		enum area area)
+{
+	uintptr_t value = target;
+	struct reloc reloc = { field, area };
+
+	memcpy(w->nodes.data + field, &value, sizeof(value));
+	buffer_append(&w->relocs, &reloc, sizeof(reloc));
+}
+
+static size_t write_command(struct ast_writer *w, const command_t *cmd,
+		size_t up);
+
+/**
+ * Write a list of words (following next_word) or the parts of a word
+ * (following next_part) and return the offset of the first one. The
+ * chains are walked iteratively, a command can have many parameters;
+ * the tree of a command substitution is written after its part.
+ */
+static size_t write_words(struct ast_writer *w, const word_t *word, bool parts)
+{
+	size_t link = parts ? offsetof(word_t, next_part) :
+		offsetof(word_t, next_word);
+	size_t first = 0, prev = 0, node;
+	bool shared;
+
+	for (; word != NULL; word = parts ? word->next_part : word->next_word) {
+		/* The rest of the list was already written with another list. */
+		shared = !parts && map_find(w, word, &node);
+		if (!shared) {
+			node = buffer_reserve(&w->nodes, ALIGN_UP(sizeof(word_t)));
+			if (!parts)
+				map_insert(w, word, node);
+
+			NODE(w, word_t, node)->length = word->length;
+			NODE(w, word_t, node)->expand = word->expand;
+			set_link(w, node + offsetof(word_t, string),
+				w->strings.size, AREA_STRINGS);
+			buffer_append(&w->strings, word->string, word->length);
+
+			if (word->command != NULL)
+				set_link(w, node + offsetof(word_t, command),
+					write_command(w, word->command, 0),
+					AREA_NODES);
+
+			if (!parts && word->next_part != NULL)
+				set_link(w, node + offsetof(word_t, next_part),
+					write_words(w, word->next_part, true),
+					AREA_NODES);
+		}
+
+		if (prev == 0)
+			first = node;
+		else
+			set_link(w, prev + link, node, AREA_NODES);
+		prev = node;
+
+		if (shared)
+			break;
+	}
+
+	return first;
+}
+
+static void write_word_field(struct ast_writer *w, size_t field,
+		const word_t *word)
+{
+	if (word != NULL)
+		set_link(w, field, write_words(w, word, false), AREA_NODES);
+}
+
+static size_t write_command(struct ast_writer *w, const command_t *cmd,
+		size_t up)
+{
+	size_t node = buffer_reserve(&w->nodes, ALIGN_UP(sizeof(command_t)));
+	const simple_command_t *scmd = cmd->scmd;
+	size_t s;
+
+	NODE(w, command_t, node)->op = cmd->op;
+	if (up != 0)
+		set_link(w, node + offsetof(command_t, up), up, AREA_NODES);
+
+	if (scmd != NULL) {
+		s = buffer_reserve(&w->nodes, ALIGN_UP(sizeof(simple_command_t)));
+		NODE(w, simple_command_t, s)->io_flags = scmd->io_flags;
+		set_link(w, s + offsetof(simple_command_t, up), node, AREA_NODES);
+		write_word_field(w, s + offsetof(simple_command_t, verb),
+			scmd->verb);
+		write_word_field(w, s + offsetof(simple_command_t, params),
+			scmd->params);
+		write_word_field(w, s + offsetof(simple_command_t, in),
+			scmd->in);
+		write_word_field(w, s + offsetof(simple_command_t, out),
+			scmd->out);
+		write_word_field(w, s + offsetof(simple_command_t, err),
+			scmd->err);
+		write_word_field(w, s + offsetof(simple_command_t, here),
+			scmd->here);
+		set_link(w, node + offsetof(command_t, scmd), s, AREA_NODES);
+	}
+
+	if (cmd->cmd1 != NULL)
+		set_link(w, node + offsetof(command_t, cmd1),
+			write_command(w, cmd->cmd1, node), AREA_NODES);
+	if (cmd->cmd2 != NULL)
+		set_link(w, node + offsetof(command_t, cmd2),
+			write_command(w, cmd->cmd2, node), AREA_NODES);
+
+	return node;
+}
+
+struct ast_writer *ast_writer_create(void)
+{
+	struct ast_writer *w = calloc(1, sizeof(*w));
+
+	if (w == NULL)
+		return NULL;
+
+	w->map_capacity = INITIAL_MAP_SIZE;
+	w->map = calloc(w->map_capacity, sizeof(*w->map));
+	if (w->map == NULL) {
+		free(w);
+		return NULL;
+	}
+
+	/* Offset 0 of the nodes stands for NULL, it is never a node. */
+	buffer_reserve(&w->nodes, NODE_ALIGN);
+
+	return w;
+}
+
+void ast_writer_add(struct ast_writer *w, command_t *root)
+{
+	uint64_t node = 0;
+
+	/* Forget the words of the previous tree. */
+	w->generation++;
+	w->map_count = 0;
+
+	if (root != NULL)
+		node = write_command(w, root, 0);
+
+	buffer_append(&w->roots, &node, sizeof(node));
+}
+
+void *ast_writer_finish(struct ast_writer *w, size_t *size)
+{
+	struct ast_image_header header;
+	const struct reloc *reloc;
+	size_t nrelocs = w->relocs.size / sizeof(*reloc);
+	uint64_t *roots, field;
+	uintptr_t value;
+	char *image;
+	size_t i;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, AST_IMAGE_MAGIC, sizeof(header.magic));
+	header.version = AST_IMAGE_VERSION;
+	header.pointer_size = sizeof(void *);
+	header.word_size = sizeof(word_t);
+	header.scmd_size = sizeof(simple_command_t);
+	header.command_size = sizeof(command_t);
+	header.nroots = w->roots.size / sizeof(uint64_t);
+	header.nrelocs = nrelocs;
+	header.roots_offset = ALIGN_UP(sizeof(header));
+	header.relocs_offset = header.roots_offset + w->roots.size;
+	header.nodes_offset = header.relocs_offset + nrelocs * sizeof(uint64_t);
+	header.strings_offset = header.nodes_offset + w->nodes.size;
+	header.size = header.strings_offset + w->strings.size;
+
+	image = malloc(header.size);
+	if (image == NULL) {
+		perror("Error allocating AST image");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(image, &header, sizeof(header));
+	memcpy(image + header.nodes_offset, w->nodes.data, w->nodes.size);
+	memcpy(image + header.strings_offset, w->strings.data, w->strings.size);
+
+	/* Offsets become relative to the start of the image. */
+	roots = (uint64_t *)(image + header.roots_offset);
+	memcpy(roots, w->roots.data, w->roots.size);
+	for (i = 0; i < header.nroots; i++)
+		if (roots[i] != 0)
+			roots[i] += header.nodes_offset;
+
+	for (i = 0; i < nrelocs; i++) {
+		reloc = (const struct reloc *)w->relocs.data + i;
+		field = header.nodes_offset + reloc->field;
+
+		memcpy(&value, image + field, sizeof(value));
+		value += reloc->area == AREA_NODES ? header.nodes_offset :
+			header.strings_offset;
+		memcpy(image + field, &value, sizeof(value));
+
+		memcpy(image + header.relocs_offset + i * sizeof(field), &field,
+			sizeof(field));
+	}
+
+	free(w->nodes.data);
+	free(w->strings.data);
+	free(w->relocs.data);
+	free(w->roots.data);
+	free(w->map);
+	free(w);
+
+	*size = header.size;
+	return image;
+}
+
+bool ast_image_probe(const void *base, size_t size)
+{
+	return size >= sizeof(struct ast_image_header) &&
+		memcmp(base, AST_IMAGE_MAGIC, 8) == 0;
+}
+
+/**
+ * Check the header: the layout must match the one of this program and
+ * the areas must follow each other inside the image.
+ */
+static bool check_header(const struct ast_image_header *h, size_t size)
+{
+	return h->version == AST_IMAGE_VERSION &&
+		h->pointer_size == sizeof(void *) &&
+		h->word_size == sizeof(word_t) &&
+		h->scmd_size == sizeof(simple_command_t) &&
+		h->command_size == sizeof(command_t) &&
+		h->size == size &&
+		h->roots_offset == ALIGN_UP(sizeof(*h)) &&
+		h->nroots <= (size - h->roots_offset) / sizeof(uint64_t) &&
+		h->relocs_offset == h->roots_offset + h->nroots * sizeof(uint64_t) &&
+		h->nrelocs <= (size - h->relocs_offset) / sizeof(uint64_t) &&
+		h->nodes_offset == h->relocs_offset + h->nrelocs * sizeof(uint64_t) &&
+		h->strings_offset >= h->nodes_offset &&
+		h->strings_offset <= size &&
+		ALIGN_UP(h->strings_offset) == h->strings_offset;
+}
+
+/*
+ * Once relocated, the trees are walked from the roots before they are
+ * handed out: every link must be NULL or point to a node of its type
+ * that lies in the nodes area (and does not overlap another one), every
+ * string must lie in the strings area, and the up links must point to
+ * the parent. A node is only reached once, but for the words shared by
+ * the out and err lists; any other cycle is refused. The state of a node
+ * is kept for its first 8 bytes.
+ */
+enum node_state {
+	NODE_NONE,
+	NODE_INSIDE,
+	NODE_WORD,
+	NODE_SCMD,
+	NODE_COMMAND,
+	NODE_DONE = 0x80
+};
+
+struct checker {
+	char *base;
+	const struct ast_image_header *header;
+	unsigned char *state;
+};
+
+/**
+ * Take the node at ptr, of the given type and size; shared is set if it
+ * was already checked (then it is not taken again).
+ */
+static bool claim_node(struct checker *c, const void *ptr, size_t size,
+		unsigned char type, bool *shared)
+{
+	const struct ast_image_header *h = c->header;
+	uintptr_t offset = (uintptr_t)ptr - (uintptr_t)c->base;
+	unsigned char *state;
+	size_t i;
+
+	if ((uintptr_t)ptr < (uintptr_t)c->base || offset < h->nodes_offset ||
+		offset % NODE_ALIGN != 0 || h->strings_offset < size ||
+		offset > h->strings_offset - size)
+		return false;
+
+	state = c->state + (offset - h->nodes_offset) / NODE_ALIGN;
+	if (state[0] != NODE_NONE) {
+		*shared = true;
+		return state[0] == (type | NODE_DONE);
+	}
+
+	for (i = 0; i < ALIGN_UP(size) / NODE_ALIGN; i++)
+		if (state[i] != NODE_NONE)
+			return false;
+
+	state[0] = type;
+	for (i = 1; i < ALIGN_UP(size) / NODE_ALIGN; i++)
+		state[i] = NODE_INSIDE;
+	*shared = false;
+
+	return true;
+}
+
+static void done_node(struct checker *c, const void *ptr)
+{
+	c->state[((const char *)ptr - c->base - c->header->nodes_offset) /
+		NODE_ALIGN] |= NODE_DONE;
+}
+
+static bool check_string(struct checker *c, const word_t *word)
+{
+	const char *strings = c->base + c->header->strings_offset;
+	const char *end = c->base + c->header->size;
+
+	return word->string >= strings && word->string <= end &&
+		word->length <= (size_t)(end - word->string);
+}
+
+static bool check_command(struct checker *c, command_t *cmd, command_t *up);
+
+/**
+ * Check a list of words (next_word) or the parts of a word (next_part),
+ * iteratively as they are written; the words stay open until the end
+ * of their list, so a list that loops on itself is refused.
+ */
+static bool check_words(struct checker *c, word_t *first, bool parts)
+{
+	word_t *word;
+	bool shared;
+
+	for (word = first; word != NULL;
+		word = parts ? word->next_part : word->next_word) {
+		if (!claim_node(c, word, sizeof(word_t), NODE_WORD, &shared))
+			return false;
+		/* The rest of the list was checked with another list. */
+		if (shared) {
+			if (parts)
+				return false;
+			break;
+		}
+
+		if (!check_string(c, word) || (parts && word->next_word != NULL))
+			return false;
+		if (word->command != NULL && !check_command(c, word->command,
+			NULL))
+			return false;
+		if (!parts && word->next_part != NULL &&
+			!check_words(c, word->next_part, true))
+			return false;
+	}
+
+	for (word = first; word != NULL && c->state[((char *)word - c->base -
+		c->header->nodes_offset) / NODE_ALIGN] == NODE_WORD;
+		word = parts ? word->next_part : word->next_word)
+		done_node(c, word);
+
+	return true;
+}
+
+static bool check_command(struct checker *c, command_t *cmd, command_t *up)
+{
+	simple_command_t *scmd;
+	bool shared;
+
+	if (!claim_node(c, cmd, sizeof(command_t), NODE_COMMAND, &shared) ||
+		shared || cmd->up != up)
+		return false;
+	cmd->aux = NULL;
+	scmd = cmd->scmd;
+
+	if (scmd != NULL) {
+		if (!claim_node(c, scmd, sizeof(simple_command_t), NODE_SCMD,
+			&shared) || shared || scmd->up != cmd)
+			return false;
+		scmd->aux = NULL;
+
+		if (!check_words(c, scmd->verb, false) ||
+			!check_words(c, scmd->params, false) ||
+			!check_words(c, scmd->in, false) ||
+			!check_words(c, scmd->out, false) ||
+			!check_words(c, scmd->err, false) ||
+			!check_words(c, scmd->here, false))
+			return false;
+		done_node(c, scmd);
+	}
+
+	if ((cmd->cmd1 != NULL && !check_command(c, cmd->cmd1, cmd)) ||
+		(cmd->cmd2 != NULL && !check_command(c, cmd->cmd2, cmd)))
+		return false;
+	done_node(c, cmd);
+
+	return true;
+}
+
+static bool check_trees(char *base, const struct ast_image_header *h)
+{
+	const uint64_t *roots = (const uint64_t *)(base + h->roots_offset);
+	struct checker c = { base, h, NULL };
+	bool ret = true;
+	size_t i;
+
+	c.state = calloc((h->strings_offset - h->nodes_offset) / NODE_ALIGN + 1,
+		1);
+	if (c.state == NULL)
+		return false;
+
+	for (i = 0; i < h->nroots && ret; i++)
+		if (roots[i] != 0)
+			ret = check_command(&c, (command_t *)(base + roots[i]),
+				NULL);
+
+	free(c.state);
+
+	return ret;
+}
+
+struct ast_image *ast_image_open(void *base, size_t size)
+{
+	const struct ast_image_header *h = base;
+	struct ast_image *image;
+	const uint64_t *relocs;
+	char *data = base;
+	uint64_t value;
+	char *pointer;
+	size_t i;
+
+	if (!ast_image_probe(base, size) || !check_header(h, size))
+		return NULL;
+
+	/* Every root is a node, every link points inside the image. */
+	for (i = 0; i < h->nroots; i++) {
+		value = ((const uint64_t *)(data + h->roots_offset))[i];
+		if (value != 0 && (value < h->nodes_offset ||
+			value + sizeof(command_t) > h->strings_offset ||
+			value % NODE_ALIGN != 0))
+			return NULL;
+	}
+
+	relocs = (const uint64_t *)(data + h->relocs_offset);
+	for (i = 0; i < h->nrelocs; i++) {
+		if (relocs[i] < h->nodes_offset || relocs[i] % sizeof(pointer) ||
+			relocs[i] + sizeof(pointer) > h->strings_offset)
+			return NULL;
+
+		memcpy(&value, data + relocs[i], sizeof(value));
+		if (value < h->nodes_offset || value > size)
+			return NULL;
+
+		pointer = data + value;
+		memcpy(data + relocs[i], &pointer, sizeof(pointer));
+	}
+
+	if (!check_trees(data, h))
+		return NULL;
+
+	image = malloc(sizeof(*image));
+	if (image == NULL)
+		return NULL;
+
+	image->base = data;
+	image->size = size;
+	image->mapped = false;
+	image->header = h;
+	image->roots = (const uint64_t *)(data + h->roots_offset);
+
+	return image;
+}
+
+struct ast_image *ast_image_load(const char *path)
+{
+	struct ast_image *image = NULL;
+	struct stat st;
+	void *base;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0);
+		if (base != MAP_FAILED) {
+			image = ast_image_open(base, st.st_size);
+			if (image != NULL)
+				image->mapped = true;
+			else
+				munmap(base, st.st_size);
+		}
+	}
+
+	close(fd);
+
+	return image;
+}
+
+size_t ast_image_count(const struct ast_image *image)
+{
+	return image->header->nroots;
+}
+
+command_t *ast_image_root(const struct ast_image *image, size_t index)
+{
+	if (index >= image->header->nroots || image->roots[index] == 0)
+		return NULL;
+
+	return (command_t *)(image->base + image->roots[index]);
+}
+
+void ast_image_close(struct ast_image *image)
+{
+	if (image == NULL)
+		return;
+
+	if (image->mapped)
+		munmap(image->base, image->size);
+	free(image);
+}
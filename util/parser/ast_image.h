@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef __AST_IMAGE_H
+#define __AST_IMAGE_H
+
+/*
+ * Binary images of parse trees
+
+ * An image holds the trees of several lines (e.g. all the lines of a
+ * script) in a single relocatable block:
+
+ *   header | roots | relocations | nodes | strings
+
+ * The nodes are the command_t, simple_command_t and word_t structures
+ * themselves, but their pointers hold offsets from the start of the
+ * image; the relocation table lists the offset of every such pointer,
+ * so loading an image only adds the address it was loaded at to each
+ * of them. All the word strings live in the string table; like in the
+ * trees returned by the parser they are not null terminated.
+
+ * Lines that were empty have a NULL root. The layout of the structures
+ * is recorded in the header, images are only loaded by a program built
+ * for the same architecture.
+
+ * The aux fields are NULL in the loaded trees, they can be used as in
+ * the trees built by the parser.
+ */
+
+#include <stddef.h>
+
+#include "parser.h"
+
+#define AST_IMAGE_MAGIC		"MSHAST\r\n"
+#define AST_IMAGE_VERSION	3
+
+struct ast_writer;
+struct ast_image;
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*
+ * Writing an image: add the root of every line (NULL for empty lines),
+ * in order; the tree is copied right away, so it can be freed after
+ * ast_writer_add returns. ast_writer_finish frees the writer and returns
+ * the image (allocated with malloc) and its size.
+ */
+
+struct ast_writer *ast_writer_create(void);
+void ast_writer_add(struct ast_writer *writer, command_t *root);
+void *ast_writer_finish(struct ast_writer *writer, size_t *size);
+
+/*
+ * Loading an image
+
+ * ast_image_probe tells if a buffer starts like an image
+
+ * ast_image_open relocates the image found in base (writable, aligned
+ * to 8 bytes) in place; base must outlive the image. NULL is returned if
+ * the image is invalid or was built for a different architecture: every
+ * tree is walked and its links and strings checked, so that a corrupted
+ * image is refused rather than read out of bounds.
+
+ * ast_image_load maps a file privately and relocates it
+
+ * ast_image_close frees the image (and unmaps it if it was loaded from
+ * a file); its trees are no longer valid afterwards
+ */
+
+bool ast_image_probe(const void *base, size_t size);
+struct ast_image *ast_image_open(void *base, size_t size);
+struct ast_image *ast_image_load(const char *path);
+size_t ast_image_count(const struct ast_image *image);
+command_t *ast_image_root(const struct ast_image *image, size_t index);
+void ast_image_close(struct ast_image *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
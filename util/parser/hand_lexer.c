@@ -0,0 +1,442 @@
+/*
+ * Hand-written lexer, an alternative to parser.l (build with LEXER=hand)
+
+ * It follows the same rules as parser.l and returns exactly the same
+ * tokens, values and locations through the same yylex contract; the
+ * runs of word characters, blanks and quoted text are skipped a whole
+ * vector at a time (AVX2 or SSE2), by turning each vector into a mask
+ * of the bytes that end the run
+
+ * The buffer given to scannerSetBuffer ends with two '\0' characters
+ * (see parse_line_buffer in parser.h); every run stops at a '\0', so
+ * the vector loops always stop inside the aligned block holding them.
+ * Vectors are loaded from aligned addresses only, so they never cross
+ * into another page, although they may read a few bytes around the line
+ */
+
+
+#ifdef __cplusplus
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+#else
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#endif
+
+#include <stdint.h>
+
+#define __PARSER_H_INTERNAL_INCLUDE
+#include "parser.h"
+#include "parser.tab.h"
+
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+typedef __m256i vec_t;
+#define VEC_SIZE		32
+#define vecLoad(p)		_mm256_load_si256((const __m256i *)(p))
+#define vecSet(c)		_mm256_set1_epi8((char)(c))
+#define vecEq(a, b)		_mm256_cmpeq_epi8((a), (b))
+#define vecGt(a, b)		_mm256_cmpgt_epi8((a), (b))
+#define vecAdd(a, b)		_mm256_add_epi8((a), (b))
+#define vecOr(a, b)		_mm256_or_si256((a), (b))
+#define vecMask(v)		((uint32_t)_mm256_movemask_epi8(v))
+#define VEC_FULL_MASK		0xffffffffU
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+typedef __m128i vec_t;
+#define VEC_SIZE		16
+#define vecLoad(p)		_mm_load_si128((const __m128i *)(p))
+#define vecSet(c)		_mm_set1_epi8((char)(c))
+#define vecEq(a, b)		_mm_cmpeq_epi8((a), (b))
+#define vecGt(a, b)		_mm_cmpgt_epi8((a), (b))
+#define vecAdd(a, b)		_mm_add_epi8((a), (b))
+#define vecOr(a, b)		_mm_or_si128((a), (b))
+#define vecMask(v)		((uint32_t)_mm_movemask_epi8(v))
+#define VEC_FULL_MASK		0xffffU
+
+#endif
+
+
+#if defined(__GNUC__) || defined(__clang__)
+#  define NO_SANITIZE_ADDRESS	__attribute__((no_sanitize_address))
+#else
+#  define NO_SANITIZE_ADDRESS
+#endif
+
+
+typedef enum {
+	LEX_INITIAL,
+	LEX_ACCEPT_ANY,
+	LEX_ACCEPT_ANY_AND_EXPANSION
+} lexer_state_t;
+
+typedef struct {
+	const char * pos;
+	const char * end;
+	lexer_state_t state;
+} hand_scanner_t;
+
+
+/* parameterValue: letters, digits and -\+:._%?*~/,![] */
+
+static int isParameterChar(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		(c >= '0' && c <= '9') || (c != '\0' && strchr("-\\+:._%?*~/,![]", c) != NULL);
+}
+
+
+static int isNameStart(unsigned char c)
+{
+	return c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+
+static int isNameChar(unsigned char c)
+{
+	return isNameStart(c) || (c >= '0' && c <= '9');
+}
+
+
+#ifdef VEC_SIZE
+
+/* bytes in [lo, lo + n) */
+static inline vec_t vecRange(vec_t v, unsigned char lo, int n)
+{
+	vec_t shifted = vecAdd(v, vecSet(0x80 - lo));
+
+	return vecGt(vecSet(-128 + n), shifted);
+}
+
+
+/* bytes that end a run of parameterValue characters */
+static inline uint32_t stopParameter(vec_t v)
+{
+	/* '*' '+' ',' '-' '.' '/' and '0'..'9' ':' are two ranges */
+	vec_t in = vecOr(vecRange(v, '*', 6), vecRange(v, '0', 11));
+
+	in = vecOr(in, vecRange(vecOr(v, vecSet(0x20)), 'a', 26));
+	/* '[' '\\' ']' are one range too */
+	in = vecOr(in, vecOr(vecRange(v, '[', 3), vecEq(v, vecSet('_'))));
+	in = vecOr(in, vecOr(vecEq(v, vecSet('%')), vecEq(v, vecSet('?'))));
+	in = vecOr(in, vecOr(vecEq(v, vecSet('~')), vecEq(v, vecSet('!'))));
+
+	return ~vecMask(in) & VEC_FULL_MASK;
+}
+
+
+static inline uint32_t stopBlank(vec_t v)
+{
+	return ~vecMask(vecOr(vecEq(v, vecSet(' ')), vecEq(v, vecSet('\t')))) & VEC_FULL_MASK;
+}
+
+
+static inline uint32_t stopAcceptAny(vec_t v)
+{
+	return vecMask(vecOr(vecEq(v, vecSet('\'')), vecEq(v, vecSet('\0'))));
+}
+
+
+static inline uint32_t stopAcceptAnyAndExpansion(vec_t v)
+{
+	vec_t stop = vecOr(vecEq(v, vecSet('"')), vecEq(v, vecSet('$')));
+
+	return vecMask(vecOr(stop, vecEq(v, vecSet('\0'))));
+}
+
+
+/*
+ * Find the first byte at or after p for which stop() is set, starting
+ * with the aligned block that holds p
+ */
+#define DEFINE_SPAN(name, stop) \
+NO_SANITIZE_ADDRESS static const char * name(const char * p) \
+{ \
+	const char * block = (const char *)((uintptr_t)p & ~(uintptr_t)(VEC_SIZE - 1)); \
+	uint32_t mask = stop(vecLoad(block)) >> (p - block); \
+\
+	if (mask != 0) \
+		return p + __builtin_ctz(mask); \
+\
+	do { \
+		block += VEC_SIZE; \
+		mask = stop(vecLoad(block)); \
+	} while (mask == 0); \
+\
+	return block + __builtin_ctz(mask); \
+}
+
+#else
+
+#define DEFINE_SPAN(name, stop) \
+static const char * name(const char * p) \
+{ \
+	while (!stop((unsigned char)*p)) \
+		p++; \
+\
+	return p; \
+}
+
+#define stopParameter(c)		(!isParameterChar(c))
+#define stopBlank(c)			((c) != ' ' && (c) != '\t')
+#define stopAcceptAny(c)		((c) == '\'' || (c) == '\0')
+#define stopAcceptAnyAndExpansion(c)	((c) == '"' || (c) == '$' || (c) == '\0')
+
+#endif
+
+DEFINE_SPAN(spanParameter, stopParameter)
+DEFINE_SPAN(spanBlank, stopBlank)
+DEFINE_SPAN(spanAcceptAny, stopAcceptAny)
+DEFINE_SPAN(spanAcceptAnyAndExpansion, stopAcceptAnyAndExpansion)
+
+
+/* the same as UPD_LOCATION in parser.l */
+static void advance(hand_scanner_t * s, YYLTYPE * yylloc, size_t len)
+{
+	yylloc->first_column = yylloc->last_column;
+	yylloc->last_column += len;
+	s->pos += len;
+}
+
+
+static int token(hand_scanner_t * s, YYLTYPE * yylloc, size_t len, int tok)
+{
+	advance(s, yylloc, len);
+
+	return tok;
+}
+
+
+static int slice(hand_scanner_t * s, YYSTYPE * yylval, YYLTYPE * yylloc, size_t len, size_t offset, int tok)
+{
+	yylval->string_un.str = s->pos + offset;
+	yylval->string_un.len = len - offset;
+
+	return token(s, yylloc, len, tok);
+}
+
+
+/*
+ * $(...) up to the matching parenthesis, skipping quoted text; the value
+ * is the text between the parentheses
+ */
+static int substitution(hand_scanner_t * s, YYSTYPE * yylval, YYLTYPE * yylloc)
+{
+	const char * p;
+	const char * quote;
+	int depth = 1;
+
+	for (p = s->pos + 2; p < s->end; p++) {
+		switch (*p) {
+		case '\'':
+		case '"':
+			quote = (const char *) memchr(p + 1, *p, s->end - p - 1);
+			if (quote == NULL)
+				return UNEXPECTED_EOF;
+			p = quote;
+			break;
+		case '(':
+			depth++;
+			break;
+		case ')':
+			if (--depth > 0)
+				break;
+			yylval->string_un.str = s->pos + 2;
+			yylval->string_un.len = p - s->pos - 2;
+			return token(s, yylloc, p + 1 - s->pos, COMMAND_SUBSTITUTION);
+		}
+	}
+
+	return UNEXPECTED_EOF;
+}
+
+
+/* $name, $(...) or a lonely $ */
+static int envVar(hand_scanner_t * s, YYSTYPE * yylval, YYLTYPE * yylloc)
+{
+	const char * p = s->pos + 1;
+
+	if (*p == '(')
+		return substitution(s, yylval, yylloc);
+
+	if (!isNameStart((unsigned char)*p))
+		return token(s, yylloc, 1, INVALID_ENVIRONMENT_VAR);
+
+	while (isNameChar((unsigned char)*p))
+		p++;
+
+	return slice(s, yylval, yylloc, p - s->pos, 1, ENV_VAR);
+}
+
+
+/* quoted text; '\0' characters inside the line are part of it */
+static size_t quotedLength(hand_scanner_t * s, const char * (*span)(const char *))
+{
+	const char * p = span(s->pos);
+
+	while (*p == '\0' && p < s->end)
+		p = span(p + 1);
+
+	return p < s->end ? p - s->pos : s->end - s->pos;
+}
+
+
+static int lexInitial(hand_scanner_t * s, YYSTYPE * yylval, YYLTYPE * yylloc)
+{
+	const char * p = s->pos;
+	size_t len;
+
+	switch (*p) {
+	case '\r':
+		if (p[1] != '\n')
+			return token(s, yylloc, 1, NOT_ACCEPTED_CHAR);
+		len = 2;
+		break;
+	case '\n':
+		len = 1;
+		break;
+	case '\'':
+		advance(s, yylloc, 1);
+		s->state = LEX_ACCEPT_ANY;
+		return -1;
+	case '"':
+		advance(s, yylloc, 1);
+		s->state = LEX_ACCEPT_ANY_AND_EXPANSION;
+		return -1;
+	case ';':
+		return token(s, yylloc, 1, SEQUENTIAL);
+	case '|':
+		if (p[1] == '|')
+			return token(s, yylloc, 2, CONDITIONAL_NZERO);
+		return token(s, yylloc, 1, PIPE);
+	case '&':
+		if (p[1] == '&')
+			return token(s, yylloc, 2, CONDITIONAL_ZERO);
+		if (p[1] == '>')
+			return token(s, yylloc, 2, REDIRECT_OE);
+		return token(s, yylloc, 1, PARALLEL);
+	case '2':
+		if (p[1] == '>' && p[2] == '>')
+			return token(s, yylloc, 3, REDIRECT_APPEND_E);
+		if (p[1] == '>')
+			return token(s, yylloc, 2, REDIRECT_E);
+		return slice(s, yylval, yylloc, spanParameter(p) - p, 0, WORD);
+	case '>':
+		if (p[1] == '>')
+			return token(s, yylloc, 2, REDIRECT_APPEND_O);
+		return token(s, yylloc, 1, REDIRECT_O);
+	case '<':
+		if (p[1] == '<' && p[2] == '<')
+			return token(s, yylloc, 3, HERE_STRING);
+		if (p[1] == '<')
+			return token(s, yylloc, 2, HERE_DOC);
+		return token(s, yylloc, 1, INDIRECT);
+	case ' ':
+	case '\t':
+		return token(s, yylloc, spanBlank(p) - p, BLANK);
+	case '=':
+		return slice(s, yylval, yylloc, 1, 0, WORD);
+	case '$':
+		return envVar(s, yylval, yylloc);
+	default:
+		if (isParameterChar((unsigned char)*p))
+			return slice(s, yylval, yylloc, spanParameter(p) - p, 0, WORD);
+		return token(s, yylloc, 1, NOT_ACCEPTED_CHAR);
+	}
+
+	/* a new line must end the buffer */
+	if (p + len < s->end)
+		return token(s, yylloc, len + 1, CHARS_AFTER_EOL);
+
+	return token(s, yylloc, len, END_OF_LINE);
+}
+
+
+int yylex(YYSTYPE * yylval, YYLTYPE * yylloc, void * scanner)
+{
+	hand_scanner_t * s = (hand_scanner_t *) scanner;
+	int tok = -1;
+
+	while (tok < 0) {
+		if (s->pos >= s->end)
+			return s->state == LEX_INITIAL ? END_OF_FILE : UNEXPECTED_EOF;
+
+		switch (s->state) {
+		case LEX_INITIAL:
+			tok = lexInitial(s, yylval, yylloc);
+			break;
+		case LEX_ACCEPT_ANY:
+			if (*s->pos == '\'') {
+				advance(s, yylloc, 1);
+				s->state = LEX_INITIAL;
+			} else {
+				tok = slice(s, yylval, yylloc, quotedLength(s, spanAcceptAny), 0, WORD);
+			}
+			break;
+		case LEX_ACCEPT_ANY_AND_EXPANSION:
+			if (*s->pos == '"') {
+				advance(s, yylloc, 1);
+				s->state = LEX_INITIAL;
+			} else if (*s->pos == '$') {
+				tok = envVar(s, yylval, yylloc);
+			} else {
+				tok = slice(s, yylval, yylloc, quotedLength(s, spanAcceptAnyAndExpansion), 0, WORD);
+			}
+			break;
+		}
+	}
+
+	return tok;
+}
+
+
+void * scannerCreate(void)
+{
+	hand_scanner_t * s = (hand_scanner_t *) calloc(1, sizeof(hand_scanner_t));
+
+	if (s == NULL) {
+		fprintf(stderr, "calloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return s;
+}
+
+
+void scannerSetBuffer(void * scanner, char * buf, size_t size)
+{
+	hand_scanner_t * s = (hand_scanner_t *) scanner;
+
+	/* buf ends with two '\0', they are not part of the line */
+	s->pos = buf;
+	s->end = buf + size - 2;
+	s->state = LEX_INITIAL;
+}
+
+
+void scannerEndBuffer(void * scanner)
+{
+	hand_scanner_t * s = (hand_scanner_t *) scanner;
+
+	s->pos = s->end = NULL;
+}
+
+
+void scannerDestroy(void * scanner)
+{
+	free(scanner);
+}
@@ -19,6 +19,9 @@
  */
 
 
+#include <stddef.h>
+
+
 
 #ifdef __cplusplus
 #else
@@ -47,6 +50,16 @@ typedef enum {
  * Some parts might need environment variable expansion (expand == true);
  * if that is the case, "string" points to the environment variable name
 
+ * "string" points directly into the parsed line and is NOT null
+ * terminated; "length" holds the number of characters of the part
+
+ * A part entered as $(...) is a command substitution: command points to
+ * the parse tree of the command between the parentheses and "string" to
+ * its text (expand is false); command is NULL in the other parts. The
+ * tree is a separate one, its root has up == NULL. An empty substitution
+ * ("$()" or "$( )") is an empty part. Here-documents are not accepted
+ * inside a command substitution
+
  * The next string literal is pointed to by next_word
  * (NULL if there are no more list elements)
 
@@ -64,7 +77,9 @@ typedef enum {
 
 typedef struct word_t {
 	const char *string;
+	size_t length;
 	bool expand;
+	struct command_t *command;
 	struct word_t *next_part;
 	struct word_t *next_word;
 } word_t;
@@ -93,6 +108,16 @@ typedef struct word_t {
 
  * io_flags is used to specify special modes for redirection (e.g. appending)
 
+ * here points to the text fed to the standard input of the command by a
+ * here-string (IO_HERE_STRING, "command <<< word": the word followed by
+ * a "\n" part) or a here-document (IO_HERE_DOC, "command << END": the
+ * lines that follow, up to the one holding just END, each one ending
+ * with a "\n" part); the variables in a here-document are parts to
+ * expand, unless END was quoted. When a command has more than one of
+ * them, the last one is kept. The lines of a here-document are not part
+ * of the parsed line, see parse_heredoc_line_r; until they are given,
+ * here is NULL (an empty document)
+
  * Some string literals can be found in both the out list and the err list
  * (those entered as "command &> out").
 
@@ -103,6 +128,8 @@ typedef struct word_t {
 #define IO_REGULAR	0x00
 #define IO_OUT_APPEND	0x01
 #define IO_ERR_APPEND	0x02
+#define IO_HERE_STRING	0x04
+#define IO_HERE_DOC	0x08
 
 typedef struct {
 	word_t *verb;
@@ -110,6 +137,7 @@ typedef struct {
 	word_t *in;
 	word_t *out;
 	word_t *err;
+	word_t *here;
 	int io_flags;
 	struct command_t *up;
 	void *aux;
@@ -148,7 +176,8 @@ typedef enum {
  *  else
       scmd == NULL
       cmd1 != NULL
-      cmd2 != NULL
+      cmd2 != NULL, except for a trailing & (op == OP_PARALLEL), which
+      leaves cmd2 == NULL
       cmd1 op cmd2 must be executed, according to the rules for op
 
  * You can use aux the same way as for simple_command_t
@@ -209,6 +238,19 @@ void parse_error(const char *str, const int where);
 bool parse_line(const char *line, command_t **root);
 
 
+/*
+ * Same as parse_line, but the line is scanned in place instead of
+ * being copied first
+
+ * buf points to len characters holding a single line, followed by
+ * two '\0' characters (buf[len] == buf[len + 1] == '\0'); the lexer
+ * temporarily writes to it while scanning, and the strings of the
+ * parse tree point into it, so buf must outlive the tree
+ */
+
+bool parse_line_buffer(char *buf, size_t len, command_t **root);
+
+
 /*
  * Should be called to free the parse tree
  * call this even if parse_line() returned false
@@ -216,6 +258,53 @@ bool parse_line(const char *line, command_t **root);
 
 void free_parse_memory(void);
 
+
+/*
+ * Reentrant API
+
+ * parse_line, parse_line_buffer and free_parse_memory share a single
+ * hidden context, so they can only be used from one thread at a time
+ * and only one parse tree can be alive at any moment
+
+ * A parser_ctx_t owns all the memory of the trees parsed with it;
+ * different contexts can be used concurrently from different threads
+ * (parse_error must then be thread safe as well)
+
+ * parse_line_r works as parse_line, except that line holds len
+ * characters and does not have to be null terminated; the tree lives
+ * until the next call with the same context, free_parse_memory_r or
+ * parser_ctx_destroy
+
+ * parse_line_buffer_r works as parse_line_buffer
+
+ * parser_ctx_memory returns the number of bytes the context holds for
+ * its trees (this memory is kept until the context is destroyed)
+
+ * Here-documents
+
+ * When a parsed line holds here-documents, the lines that follow it in
+ * the input are their bodies: parse_heredoc_pending_r tells whether the
+ * tree still waits for lines, and parse_heredoc_line_r gives it the next
+ * one (len characters, an ending "\n" or "\r\n" is ignored); it returns
+ * parse_heredoc_pending_r afterwards. The bodies are copied to the
+ * context and live as long as the tree
+ */
+
+typedef struct parser_ctx_t parser_ctx_t;
+
+parser_ctx_t *parser_ctx_create(void);
+void parser_ctx_destroy(parser_ctx_t *ctx);
+
+bool parse_line_r(parser_ctx_t *ctx, const char *line, size_t len,
+		command_t **root);
+bool parse_line_buffer_r(parser_ctx_t *ctx, char *buf, size_t len,
+		command_t **root);
+void free_parse_memory_r(parser_ctx_t *ctx);
+size_t parser_ctx_memory(parser_ctx_t *ctx);
+
+bool parse_heredoc_pending_r(parser_ctx_t *ctx);
+bool parse_heredoc_line_r(parser_ctx_t *ctx, const char *line, size_t len);
+
 #ifdef __cplusplus
 }
 #endif
@@ -227,12 +316,21 @@ void free_parse_memory(void);
  * Parser and lexer common internal stuff
  */
 
-typedef void *GenericPointer;
+typedef struct {
+	const char *str;
+	size_t len;
+} slice_t;
+
+typedef struct {
+	word_t *head;
+	word_t *tail;
+} word_list_t;
 
 typedef struct {
-	word_t *red_i;
-	word_t *red_o;
-	word_t *red_e;
+	word_list_t red_i;
+	word_list_t red_o;
+	word_list_t red_e;
+	word_t *red_here;
 	int red_flags;
 } redirect_t;
 
@@ -242,10 +340,10 @@ extern "C"
 {
 #endif
 
-void pointerToMallocMemory(const void *ptr);
-int yylex(void);
-void globalParseAnotherString(const char *str);
-void globalEndParsing(void);
+void *scannerCreate(void);
+void scannerSetBuffer(void *scanner, char *buf, size_t size);
+void scannerEndBuffer(void *scanner);
+void scannerDestroy(void *scanner);
 
 #ifdef __cplusplus
 }
@@ -1,5 +1,8 @@
 %defines
 %locations
+%define api.pure full
+%parse-param {parser_ctx_t * ctx} {void * scanner}
+%lex-param {void * scanner}
 %{
 
 
@@ -16,6 +19,7 @@
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <cctype>
 
 using namespace std;
 
@@ -25,6 +29,7 @@ using namespace std;
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 
 #endif
 
@@ -33,90 +38,158 @@ using namespace std;
 #include "parser.h"
 
 
-static GenericPointer * globalAllocMem = NULL;
-static size_t globalAllocCount = 0;
-static size_t globalAllocSize  = 0;
-static bool needsFree = false;
-static command_t * command_root = NULL;
+/*
+ * All the memory of a parse tree (nodes and the copy of the line)
+ * comes from a bump allocator owned by the parser context; the chunks
+ * are kept between calls to parse_line_r, so freeing the tree only
+ * rewinds the allocator
+ */
+
+#define ARENA_CHUNK_SIZE	4096
+#define ARENA_ALIGN		(2 * sizeof(void *))
+
+typedef struct arena_chunk_t {
+	struct arena_chunk_t * next;
+	size_t size;
+} arena_chunk_t;
+
+#define ARENA_CHUNK_HEADER \
+	((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/*
+ * A here-document of the parsed line, waiting for its body; the ones of
+ * a line are queued in order, the body of a document that was replaced
+ * by a later one on the same command (scmd == NULL) is read and dropped
+ */
+
+typedef struct heredoc_t {
+	struct heredoc_t * next;
+	simple_command_t * scmd;
+	const char * delimiter;
+	size_t delimiterLen;
+	bool expand;
+	word_list_t body;
+} heredoc_t;
+
+/*
+ * Everything a parse needs lives in its context, so several contexts can
+ * be used at the same time from different threads; each level of nested
+ * command substitutions is parsed with a scanner of its own, and its
+ * error locations are shifted by the column the substitution starts at
+ */
+
+#define SUBSTITUTION_DEPTH	16
+
+struct parser_ctx_t {
+	arena_chunk_t * arenaHead;
+	arena_chunk_t * arenaCurrent;
+	size_t arenaOffset;
+	void * scanner;
+	bool needsFree;
+	command_t * command_root;
+	heredoc_t * heredocHead;
+	heredoc_t * heredocTail;
+	heredoc_t * heredocUnbound;
+	void * nestedScanners[SUBSTITUTION_DEPTH];
+	int depth;
+	int columnOffset;
+};
+
+
+/* used by the non reentrant API (parse_line and free_parse_memory) */
+static parser_ctx_t * defaultCtx = NULL;
+
+
+static arena_chunk_t * newChunk(size_t size, arena_chunk_t * next)
+{
+	arena_chunk_t * chunk;
 
+	if (size < ARENA_CHUNK_SIZE)
+		size = ARENA_CHUNK_SIZE;
 
-void yyerror(const char* str);
+	chunk = (arena_chunk_t *)malloc(ARENA_CHUNK_HEADER + size);
+	if (chunk == NULL) {
+		fprintf(stderr, "malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	chunk->next = next;
+	chunk->size = size;
+
+	return chunk;
+}
 
 
-static void ensureSize(size_t newSize)
+static void * arenaAlloc(parser_ctx_t * ctx, size_t size)
 {
-	GenericPointer * newPtr;
-	assert(newSize > 0);
-
-	if (globalAllocSize == 0) {
-		assert(globalAllocMem == NULL);
-		globalAllocSize = newSize;
-		globalAllocMem = (GenericPointer *)malloc(sizeof(GenericPointer) * globalAllocSize);
-		if (globalAllocMem == NULL) {
-			fprintf(stderr, "malloc() failed\n");
-			exit(EXIT_FAILURE);
-		}
+	void * ptr;
 
-		return;
-	}
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
 
-	assert(globalAllocMem != NULL);
-	if (globalAllocSize >= newSize) {
-		return;
+	if (ctx->arenaCurrent == NULL) {
+		assert(ctx->arenaHead == NULL);
+		ctx->arenaHead = ctx->arenaCurrent = newChunk(size, NULL);
+		ctx->arenaOffset = 0;
 	}
 
-	globalAllocSize += newSize;
-	newPtr = (GenericPointer *)realloc((void *)globalAllocMem, sizeof(GenericPointer) * globalAllocSize);
-	if (newPtr == NULL) {
-		fprintf(stderr, "realloc() failed\n");
-		exit(EXIT_FAILURE);
+	if (ctx->arenaCurrent->size - ctx->arenaOffset < size) {
+		/*
+		 reuse the next chunk if it is big enough, otherwise
+		 insert a fresh one before it so it can still be reused
+		 by smaller requests on the following lines
+		*/
+		if ((ctx->arenaCurrent->next == NULL) || (ctx->arenaCurrent->next->size < size))
+			ctx->arenaCurrent->next = newChunk(size, ctx->arenaCurrent->next);
+
+		ctx->arenaCurrent = ctx->arenaCurrent->next;
+		ctx->arenaOffset = 0;
 	}
 
-	globalAllocMem = newPtr;
+	ptr = (char *)ctx->arenaCurrent + ARENA_CHUNK_HEADER + ctx->arenaOffset;
+	ctx->arenaOffset += size;
+
+	return ptr;
 }
 
 
-void pointerToMallocMemory(const void * ptr)
+static void arenaReset(parser_ctx_t * ctx)
 {
-	if (ptr == NULL) {
-		fprintf(stderr, "malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
-
-	ensureSize(globalAllocCount + 1);
-	globalAllocMem[globalAllocCount++] = (GenericPointer)ptr;
+	ctx->arenaCurrent = ctx->arenaHead;
+	ctx->arenaOffset = 0;
 }
 
 
-static simple_command_t * bind_parts(word_t * exe_name, word_t * params, redirect_t red)
+static simple_command_t * bind_parts(parser_ctx_t * ctx, word_t * exe_name, word_t * params, redirect_t red)
 {
-	simple_command_t * s = (simple_command_t *) malloc(sizeof(simple_command_t));
-	pointerToMallocMemory(s);
+	simple_command_t * s = (simple_command_t *) arenaAlloc(ctx, sizeof(simple_command_t));
+	heredoc_t * doc;
 
 	memset(s, 0, sizeof(*s));
 	assert(exe_name != NULL);
 	assert(exe_name->next_word == NULL);
 	s->verb = exe_name;
 	s->params = params;
-	s->in = red.red_i;
-	s->out = red.red_o;
-	s->err = red.red_e;
+	s->in = red.red_i.head;
+	s->out = red.red_o.head;
+	s->err = red.red_e.head;
+	s->here = red.red_here;
 	s->io_flags = red.red_flags;
 	s->up = NULL;
 	s->aux = NULL;
+
+	/* the last here-document of the command gets the body it reads */
+	for (doc = ctx->heredocUnbound; doc != NULL; doc = doc->next)
+		if ((doc->next == NULL) && (red.red_flags & IO_HERE_DOC))
+			doc->scmd = s;
+	ctx->heredocUnbound = NULL;
+
 	return s;
 }
 
 
-static command_t * new_command(simple_command_t * scmd)
+static command_t * new_command(parser_ctx_t * ctx, simple_command_t * scmd)
 {
-	command_t * c = (command_t *) malloc(sizeof(command_t));
-
-	if (c == NULL) {
-		fprintf(stderr, "malloc() failed\n");
-		exit(EXIT_FAILURE);
-	}
-	pointerToMallocMemory(c);
+	command_t * c = (command_t *) arenaAlloc(ctx, sizeof(command_t));
 
 	memset(c, 0, sizeof(*c));
 	c->up = c->cmd1 = c->cmd2 = NULL;
@@ -129,10 +202,9 @@ static command_t * new_command(simple_command_t * scmd)
 }
 
 
-static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t op)
+static command_t * bind_commands(parser_ctx_t * ctx, command_t * cmd1, command_t * cmd2, operator_t op)
 {
-	command_t * c = (command_t *) malloc(sizeof(command_t));
-	pointerToMallocMemory(c);
+	command_t * c = (command_t *) arenaAlloc(ctx, sizeof(command_t));
 
 	memset(c, 0, sizeof(*c));
 	c->up = NULL;
@@ -140,11 +212,14 @@ static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t
 	assert(cmd1->up == NULL);
 	c->cmd1 = cmd1;
 	cmd1->up = c;
-	assert(cmd2 != NULL);
-	assert(cmd2->up == NULL);
-	assert(cmd1 != cmd2);
+	/* Only a trailing & leaves the second command out. */
+	assert(cmd2 != NULL || op == OP_PARALLEL);
 	c->cmd2 = cmd2;
-	cmd2->up = c;
+	if (cmd2 != NULL) {
+		assert(cmd2->up == NULL);
+		assert(cmd1 != cmd2);
+		cmd2->up = c;
+	}
 	assert((op > OP_NONE) && (op < OP_DUMMY));
 	c->op = op;
 	c->scmd = NULL;
@@ -154,15 +229,16 @@ static command_t * bind_commands(command_t * cmd1, command_t * cmd2, operator_t
 }
 
 
-static word_t * new_word(const char * str, bool expand)
+static word_t * new_word(parser_ctx_t * ctx, slice_t str, bool expand)
 {
-	word_t * w = (word_t *) malloc(sizeof(word_t));
-	pointerToMallocMemory(w);
+	word_t * w = (word_t *) arenaAlloc(ctx, sizeof(word_t));
 
 	memset(w, 0, sizeof(*w));
-	assert(str != NULL);
-	w->string = str;
+	assert(str.str != NULL);
+	w->string = str.str;
+	w->length = str.len;
 	w->expand = expand;
+	w->command = NULL;
 	w->next_part = NULL;
 	w->next_word = NULL;
 
@@ -170,24 +246,30 @@ static word_t * new_word(const char * str, bool expand)
 }
 
 
-static word_t * add_part_to_word(word_t * w, word_t * lst)
+static word_list_t new_list(word_t * w)
+{
+	word_list_t lst;
+
+	lst.head = lst.tail = w;
+
+	return lst;
+}
+
+
+static word_list_t add_part_to_word(word_t * w, word_list_t lst)
 {
-	word_t * crt = lst;
-	assert(lst != NULL);
+	assert(lst.tail != NULL);
 	assert(w != NULL);
 
 	/*
-	 we could insert at the beginnig and then invert the list
-	 but this would make the code a bit more complicated
-	 thus, we assume we have small lists and O(n*n) is acceptable
+	 the list carries its tail, so appending is O(1) and
+	 building a word out of n parts is O(n)
 	*/
 
-	while (crt->next_part != NULL) {
-		crt = crt->next_part;
-		assert((crt == NULL) || (crt->next_word == NULL));
-	}
-
-	crt->next_part = w;
+	assert(lst.tail->next_part == NULL);
+	assert(lst.tail->next_word == NULL);
+	lst.tail->next_part = w;
+	lst.tail = w;
 	assert(w->next_part == NULL);
 	assert(w->next_word == NULL);
 
@@ -195,50 +277,203 @@ static word_t * add_part_to_word(word_t * w, word_t * lst)
 }
 
 
-static word_t * add_word_to_list(word_t * w, word_t * lst)
+static word_list_t add_word_to_list(word_t * w, word_list_t lst)
 {
-	word_t * crt = lst;
 	assert(w != NULL);
 
-	if (crt == NULL) {
+	if (lst.head == NULL) {
 		assert(w->next_word == NULL);
-		return w;
+		return new_list(w);
 	}
-	assert(lst != NULL);
+	assert(lst.tail != NULL);
 
 	/*
-	 same as above
+	 a word redirected with &> is shared by the out and err lists,
+	 so the other list may have linked more words after our tail;
+	 catching up with them keeps the appends amortized O(1)
 	*/
-	while (crt->next_word != NULL) {
-		crt = crt->next_word;
+	while (lst.tail->next_word != NULL) {
+		if (lst.tail == w)
+			return lst;
+		lst.tail = lst.tail->next_word;
 	}
 
-	crt->next_word = w;
+	if (lst.tail == w)
+		return lst;
+
+	lst.tail->next_word = w;
+	lst.tail = w;
 	assert(w->next_word == NULL);
 
 	return lst;
 }
 
 
+static word_t * newline_word(parser_ctx_t * ctx)
+{
+	slice_t str;
+
+	str.str = "\n";
+	str.len = 1;
+
+	return new_word(ctx, str, false);
+}
+
+
+static redirect_t add_here_string(parser_ctx_t * ctx, redirect_t red, word_list_t w)
+{
+	red.red_here = add_part_to_word(newline_word(ctx), w).head;
+	red.red_flags &= ~IO_HERE_DOC;
+	red.red_flags |= IO_HERE_STRING;
+
+	return red;
+}
+
+
+static redirect_t add_here_doc(parser_ctx_t * ctx, redirect_t red, word_t * w)
+{
+	heredoc_t * doc = (heredoc_t *) arenaAlloc(ctx, sizeof(heredoc_t));
+	size_t len = 0;
+	word_t * part;
+	char * delimiter;
+
+	memset(doc, 0, sizeof(*doc));
+
+	/*
+	 the delimiter is the word as it was written, without the quotes;
+	 like in sh, quoting any part of it keeps the body from expansion
+	*/
+	doc->expand = true;
+	for (part = w; part != NULL; part = part->next_part) {
+		len += part->length + (part->expand ? 1 : 0) + (part->command ? 3 : 0);
+		if (!part->expand && ((part->string[-1] == '\'') || (part->string[-1] == '"')))
+			doc->expand = false;
+	}
+
+	delimiter = (char *) arenaAlloc(ctx, len);
+	doc->delimiter = delimiter;
+	doc->delimiterLen = len;
+	for (part = w; part != NULL; part = part->next_part) {
+		if (part->expand || part->command) {
+			*delimiter++ = '$';
+			if (part->command)
+				*delimiter++ = '(';
+		}
+		memcpy(delimiter, part->string, part->length);
+		delimiter += part->length;
+		if (part->command)
+			*delimiter++ = ')';
+	}
+
+	if (ctx->heredocTail != NULL)
+		ctx->heredocTail->next = doc;
+	else
+		ctx->heredocHead = doc;
+	ctx->heredocTail = doc;
+	if (ctx->heredocUnbound == NULL)
+		ctx->heredocUnbound = doc;
+
+	red.red_here = NULL;
+	red.red_flags &= ~IO_HERE_STRING;
+	red.red_flags |= IO_HERE_DOC;
+
+	return red;
+}
+
+
 %}
 
 %union {
 	command_t * command_un;
-	const char * string_un;
+	slice_t string_un;
 	redirect_t redirect_un;
 	simple_command_t * simple_command_un;
 	word_t * exe_un;
-	word_t * params_un;
-	word_t * word_un;
+	word_list_t params_un;
+	word_list_t word_un;
+}
+
+
+%code {
+
+int yylex(YYSTYPE * lvalp, YYLTYPE * llocp, void * scanner);
+void yyerror(YYLTYPE * llocp, parser_ctx_t * ctx, void * scanner, const char * str);
+
+
+/*
+ * Parse the text of a $(...) part with the scanner of the next level;
+ * the text is copied, as the scanner needs the two '\0' after it.
+ * Returns NULL (the error was reported) if the command is invalid
+ */
+static word_t * new_substitution(parser_ctx_t * ctx, slice_t str, const YYLTYPE * loc)
+{
+	command_t * outerRoot = ctx->command_root;
+	heredoc_t * outerTail = ctx->heredocTail;
+	heredoc_t * outerUnbound = ctx->heredocUnbound;
+	int outerOffset = ctx->columnOffset;
+	void * scanner;
+	word_t * w;
+	char * buf;
+	int ret;
+
+	if (ctx->depth == SUBSTITUTION_DEPTH) {
+		parse_error("command substitution nested too deep", outerOffset + loc->first_column);
+		return NULL;
+	}
+
+	if (ctx->nestedScanners[ctx->depth] == NULL)
+		ctx->nestedScanners[ctx->depth] = scannerCreate();
+	scanner = ctx->nestedScanners[ctx->depth];
+
+	buf = (char *) arenaAlloc(ctx, str.len + 2);
+	memcpy(buf, str.str, str.len);
+	buf[str.len] = buf[str.len + 1] = '\0';
+
+	ctx->depth++;
+	ctx->columnOffset = outerOffset + loc->first_column + 2;
+	ctx->heredocUnbound = NULL;
+	scannerSetBuffer(scanner, buf, str.len + 2);
+	ret = yyparse(ctx, scanner);
+	scannerEndBuffer(scanner);
+	ctx->depth--;
+	ctx->columnOffset = outerOffset;
+	ctx->heredocUnbound = outerUnbound;
+
+	if ((ret == 0) && (ctx->heredocTail != outerTail)) {
+		parse_error("here-document in a command substitution", outerOffset + loc->first_column);
+		ret = 1;
+	}
+
+	if (ret != 0) {
+		ctx->command_root = outerRoot;
+		return NULL;
+	}
+
+	w = new_word(ctx, str, false);
+	w->command = ctx->command_root;
+	ctx->command_root = outerRoot;
+
+	/* nothing to run, like an empty quoted string */
+	if (w->command == NULL)
+		w->length = 0;
+
+	return w;
 }
 
+}
+
+%initial-action {
+	@$.first_line = @$.last_line = 1;
+	@$.first_column = @$.last_column = 0;
+}
 
 %token NOT_ACCEPTED_CHAR INVALID_ENVIRONMENT_VAR UNEXPECTED_EOF CHARS_AFTER_EOL
 %token END_OF_FILE END_OF_LINE BLANK
-%token REDIRECT_OE REDIRECT_O REDIRECT_E INDIRECT
+%token REDIRECT_OE REDIRECT_O REDIRECT_E INDIRECT HERE_STRING HERE_DOC
 %token REDIRECT_APPEND_E REDIRECT_APPEND_O
 %token <string_un> WORD
 %token <string_un> ENV_VAR
+%token <string_un> COMMAND_SUBSTITUTION
 
 %left SEQUENTIAL
 %left PARALLEL
@@ -259,32 +494,32 @@ static word_t * add_word_to_list(word_t * w, word_t * lst)
 command_tree:
 
 	  command END_OF_LINE {
-		command_root = $1;
+		ctx->command_root = $1;
 		YYACCEPT;
 	}
 
 	| command END_OF_FILE {
-		command_root = $1;
+		ctx->command_root = $1;
 		YYACCEPT;
 	}
 
 	| END_OF_LINE {
-		command_root = NULL;
+		ctx->command_root = NULL;
 		YYACCEPT;
 	}
 
 	| END_OF_FILE {
-		command_root = NULL;
+		ctx->command_root = NULL;
 		YYACCEPT;
 	}
 
 	| BLANK END_OF_LINE {
-		command_root = NULL;
+		ctx->command_root = NULL;
 		YYACCEPT;
 	}
 
 	| BLANK END_OF_FILE {
-		command_root = NULL;
+		ctx->command_root = NULL;
 		YYACCEPT;
 	}
 
@@ -293,27 +528,35 @@ command_tree:
 command:
 
 	  simple_command {
-		$$ = new_command($1);
+		$$ = new_command(ctx, $1);
 	}
 
 	| command SEQUENTIAL command {
-		$$ = bind_commands($1, $3, OP_SEQUENTIAL);
+		$$ = bind_commands(ctx, $1, $3, OP_SEQUENTIAL);
 	}
 
 	| command PARALLEL command {
-		$$ = bind_commands($1, $3, OP_PARALLEL);
+		$$ = bind_commands(ctx, $1, $3, OP_PARALLEL);
+	}
+
+	| command PARALLEL {
+		$$ = bind_commands(ctx, $1, NULL, OP_PARALLEL);
+	}
+
+	| command PARALLEL BLANK {
+		$$ = bind_commands(ctx, $1, NULL, OP_PARALLEL);
 	}
 
 	| command CONDITIONAL_ZERO command {
-		$$ = bind_commands($1, $3, OP_CONDITIONAL_ZERO);
+		$$ = bind_commands(ctx, $1, $3, OP_CONDITIONAL_ZERO);
 	}
 
 	| command CONDITIONAL_NZERO command {
-		$$ = bind_commands($1, $3, OP_CONDITIONAL_NZERO);
+		$$ = bind_commands(ctx, $1, $3, OP_CONDITIONAL_NZERO);
 	}
 
 	| command PIPE command {
-		$$ = bind_commands($1, $3, OP_PIPE);
+		$$ = bind_commands(ctx, $1, $3, OP_PIPE);
 	}
 
 	;
@@ -321,19 +564,19 @@ command:
 simple_command:
 
 	  exe_name BLANK params redirect {
-		$$ = bind_parts($1, $3, $4);
+		$$ = bind_parts(ctx, $1, $3.head, $4);
 	}
 
 	| exe_name BLANK params BLANK redirect {
-		$$ = bind_parts($1, $3, $5);
+		$$ = bind_parts(ctx, $1, $3.head, $5);
 	}
 
 	| exe_name redirect {
-		$$ = bind_parts($1, NULL, $2);
+		$$ = bind_parts(ctx, $1, NULL, $2);
 	}
 
 	| exe_name BLANK redirect {
-		$$ = bind_parts($1, NULL, $3);
+		$$ = bind_parts(ctx, $1, NULL, $3);
 	}
 
 	;
@@ -341,11 +584,11 @@ simple_command:
 exe_name:
 
 	  word {
-		$$ = $1;
+		$$ = $1.head;
 	}
 
 	| BLANK word {
-		$$ = $2;
+		$$ = $2.head;
 	}
 
 	;
@@ -353,182 +596,295 @@ exe_name:
 params:
 
 	  params BLANK word {
-		$$ = add_word_to_list($3, $1);
-		assert($$ == $1);
+		$$ = add_word_to_list($3.head, $1);
+		assert($$.head == $1.head);
 	}
 
 	| word {
-		$$ = $1;
+		$$ = new_list($1.head);
 	}
 	;
 
 redirect:
 
 	  { /* empty */
-		$$.red_o = NULL;
-		$$.red_i = NULL;
-		$$.red_e = NULL;
+		$$.red_o = new_list(NULL);
+		$$.red_i = new_list(NULL);
+		$$.red_e = new_list(NULL);
+		$$.red_here = NULL;
 		$$.red_flags = IO_REGULAR;
 	}
 
 	| redirect REDIRECT_OE word {
-		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_o = add_word_to_list($3.head, $1.red_o);
+		$1.red_e = add_word_to_list($3.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E word {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list($3.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O word {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		$1.red_o = add_word_to_list($3.head, $1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E word {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list($3.head, $1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O word {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		$1.red_o = add_word_to_list($3.head, $1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT word {
-		$1.red_i = add_word_to_list($3, $1.red_i);
+		$1.red_i = add_word_to_list($3.head, $1.red_i);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_OE word BLANK {
-		$1.red_o = add_word_to_list($3, $1.red_o);
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_o = add_word_to_list($3.head, $1.red_o);
+		$1.red_e = add_word_to_list($3.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E word BLANK {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list($3.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O word BLANK {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		$1.red_o = add_word_to_list($3.head, $1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E word BLANK {
-		$1.red_e = add_word_to_list($3, $1.red_e);
+		$1.red_e = add_word_to_list($3.head, $1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O word BLANK {
-		$1.red_o = add_word_to_list($3, $1.red_o);
+		$1.red_o = add_word_to_list($3.head, $1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT word BLANK {
-		$1.red_i = add_word_to_list($3, $1.red_i);
+		$1.red_i = add_word_to_list($3.head, $1.red_i);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_OE BLANK word {
-		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_o = add_word_to_list($4.head, $1.red_o);
+		$1.red_e = add_word_to_list($4.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E BLANK word {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list($4.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O BLANK word {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		$1.red_o = add_word_to_list($4.head, $1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E BLANK word {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list($4.head, $1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O BLANK word {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		$1.red_o = add_word_to_list($4.head, $1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT BLANK word {
-		$1.red_i = add_word_to_list($4, $1.red_i);
+		$1.red_i = add_word_to_list($4.head, $1.red_i);
 		$$ = $1;
 	}
 	| redirect REDIRECT_OE BLANK word BLANK {
-		$1.red_o = add_word_to_list($4, $1.red_o);
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_o = add_word_to_list($4.head, $1.red_o);
+		$1.red_e = add_word_to_list($4.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_E BLANK word BLANK {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list($4.head, $1.red_e);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_O BLANK word BLANK {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		$1.red_o = add_word_to_list($4.head, $1.red_o);
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_O BLANK word BLANK {
-		$1.red_o = add_word_to_list($4, $1.red_o);
+		$1.red_o = add_word_to_list($4.head, $1.red_o);
 		$1.red_flags |= IO_OUT_APPEND;
 		$$ = $1;
 	}
 
 	| redirect REDIRECT_APPEND_E BLANK word BLANK {
-		$1.red_e = add_word_to_list($4, $1.red_e);
+		$1.red_e = add_word_to_list($4.head, $1.red_e);
 		$1.red_flags |= IO_ERR_APPEND;
 		$$ = $1;
 	}
 
 	| redirect INDIRECT BLANK word BLANK {
-		$1.red_i = add_word_to_list($4, $1.red_i);
+		$1.red_i = add_word_to_list($4.head, $1.red_i);
 		$$ = $1;
 	}
 
+	| redirect HERE_STRING word {
+		$$ = add_here_string(ctx, $1, $3);
+	}
+
+	| redirect HERE_STRING word BLANK {
+		$$ = add_here_string(ctx, $1, $3);
+	}
+
+	| redirect HERE_STRING BLANK word {
+		$$ = add_here_string(ctx, $1, $4);
+	}
+
+	| redirect HERE_STRING BLANK word BLANK {
+		$$ = add_here_string(ctx, $1, $4);
+	}
+
+	| redirect HERE_DOC word {
+		$$ = add_here_doc(ctx, $1, $3.head);
+	}
+
+	| redirect HERE_DOC word BLANK {
+		$$ = add_here_doc(ctx, $1, $3.head);
+	}
+
+	| redirect HERE_DOC BLANK word {
+		$$ = add_here_doc(ctx, $1, $4.head);
+	}
+
+	| redirect HERE_DOC BLANK word BLANK {
+		$$ = add_here_doc(ctx, $1, $4.head);
+	}
+
 	;
 
 word:
 
 	  word WORD {
-		$$ = add_part_to_word(new_word($2, false), $1);
+		$$ = add_part_to_word(new_word(ctx, $2, false), $1);
 	}
 
 	| word ENV_VAR {
-		$$ = add_part_to_word(new_word($2, true), $1);
+		$$ = add_part_to_word(new_word(ctx, $2, true), $1);
+	}
+
+	| word COMMAND_SUBSTITUTION {
+		word_t * w = new_substitution(ctx, $2, &@2);
+
+		if (w == NULL)
+			YYABORT;
+		$$ = add_part_to_word(w, $1);
 	}
 
 	| WORD {
-		$$ = new_word($1, false);
+		$$ = new_list(new_word(ctx, $1, false));
 	}
 
 	| ENV_VAR {
-		$$ = new_word($1, true);
+		$$ = new_list(new_word(ctx, $1, true));
+	}
+
+	| COMMAND_SUBSTITUTION {
+		word_t * w = new_substitution(ctx, $1, &@1);
+
+		if (w == NULL)
+			YYABORT;
+		$$ = new_list(w);
 	}
 
 	;
 %%
 
 
-bool parse_line(const char * line, command_t ** root)
+parser_ctx_t * parser_ctx_create(void)
+{
+	parser_ctx_t * ctx = (parser_ctx_t *) malloc(sizeof(parser_ctx_t));
+
+	if (ctx == NULL) {
+		fprintf(stderr, "malloc() failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->arenaHead = ctx->arenaCurrent = NULL;
+	ctx->arenaOffset = 0;
+	ctx->needsFree = false;
+	ctx->command_root = NULL;
+	ctx->scanner = scannerCreate();
+
+	return ctx;
+}
+
+
+void parser_ctx_destroy(parser_ctx_t * ctx)
+{
+	arena_chunk_t * chunk;
+	int i;
+
+	if (ctx == NULL)
+		return;
+
+	free_parse_memory_r(ctx);
+	scannerDestroy(ctx->scanner);
+	for (i = 0; i < SUBSTITUTION_DEPTH; i++)
+		if (ctx->nestedScanners[i] != NULL)
+			scannerDestroy(ctx->nestedScanners[i]);
+
+	while (ctx->arenaHead != NULL) {
+		chunk = ctx->arenaHead;
+		ctx->arenaHead = chunk->next;
+		free(chunk);
+	}
+
+	free(ctx);
+}
+
+
+static bool parse_buffer(parser_ctx_t * ctx, char * buf, size_t len, command_t ** root)
+{
+	scannerSetBuffer(ctx->scanner, buf, len + 2);
+	ctx->needsFree = true;
+	ctx->command_root = NULL;
+
+	if (yyparse(ctx, ctx->scanner) != 0) {
+		/* yyparse failed, the line has no here-document to read */
+		ctx->heredocHead = ctx->heredocTail = ctx->heredocUnbound = NULL;
+		return false;
+	}
+
+	*root = ctx->command_root;
+
+	return true;
+}
+
+
+bool parse_line_r(parser_ctx_t * ctx, const char * line, size_t len, command_t ** root)
 {
-	if (*root != NULL) {
+	char * buf;
+
+	if ((ctx == NULL) || (*root != NULL)) {
 		/* see the comment in parser.h */
 		assert(false);
 		return false;
@@ -540,48 +896,174 @@ bool parse_line(const char * line, command_t ** root)
 		return false;
 	}
 
-	free_parse_memory();
-	globalParseAnotherString(line);
-	needsFree = true;
-	command_root = NULL;
+	free_parse_memory_r(ctx);
+
+	/* the only copy of the line, the tokens point into it */
+	buf = (char *) arenaAlloc(ctx, len + 2);
+	memcpy(buf, line, len);
+	buf[len] = buf[len + 1] = '\0';
+
+	return parse_buffer(ctx, buf, len, root);
+}
+
 
-	yylloc.first_line = yylloc.last_line = 1;
-	yylloc.first_column = yylloc.last_column = 0;
+bool parse_line_buffer_r(parser_ctx_t * ctx, char * buf, size_t len, command_t ** root)
+{
+	if ((ctx == NULL) || (*root != NULL)) {
+		/* see the comment in parser.h */
+		assert(false);
+		return false;
+	}
 
-	if (yyparse() != 0) {
-		/* yyparse failed */
+	if ((buf == NULL) || (buf[len] != '\0') || (buf[len + 1] != '\0')) {
+		/* see the comment in parser.h */
+		assert(false);
 		return false;
 	}
 
-	*root = command_root;
+	free_parse_memory_r(ctx);
+
+	return parse_buffer(ctx, buf, len, root);
+}
+
+
+void free_parse_memory_r(parser_ctx_t * ctx)
+{
+	if (ctx->needsFree) {
+		scannerEndBuffer(ctx->scanner);
+		arenaReset(ctx);
+		ctx->needsFree = false;
+	}
+
+	ctx->heredocHead = ctx->heredocTail = ctx->heredocUnbound = NULL;
+}
+
+
+size_t parser_ctx_memory(parser_ctx_t * ctx)
+{
+	arena_chunk_t * chunk;
+	size_t size = sizeof(*ctx);
+
+	for (chunk = ctx->arenaHead; chunk != NULL; chunk = chunk->next)
+		size += ARENA_CHUNK_HEADER + chunk->size;
+
+	return size;
+}
+
+
+bool parse_heredoc_pending_r(parser_ctx_t * ctx)
+{
+	return ctx->heredocHead != NULL;
+}
+
+
+static void add_body_part(parser_ctx_t * ctx, heredoc_t * doc, const char * str, size_t len, bool expand)
+{
+	slice_t slice;
+	word_t * w;
+
+	slice.str = str;
+	slice.len = len;
+	w = new_word(ctx, slice, expand);
+
+	if (doc->body.head == NULL)
+		doc->body = new_list(w);
+	else
+		doc->body = add_part_to_word(w, doc->body);
+	doc->scmd->here = doc->body.head;
+}
+
+
+bool parse_heredoc_line_r(parser_ctx_t * ctx, const char * line, size_t len)
+{
+	heredoc_t * doc = ctx->heredocHead;
+	const char * text;
+	char * copy;
+	size_t i, start, end;
+
+	if ((doc == NULL) || (line == NULL)) {
+		/* see the comment in parser.h */
+		assert(false);
+		return false;
+	}
+
+	if ((len > 0) && (line[len - 1] == '\n'))
+		len--;
+	if ((len > 0) && (line[len - 1] == '\r'))
+		len--;
+
+	if ((len == doc->delimiterLen) && (memcmp(line, doc->delimiter, len) == 0)) {
+		ctx->heredocHead = doc->next;
+		if (ctx->heredocHead == NULL)
+			ctx->heredocTail = NULL;
+		return parse_heredoc_pending_r(ctx);
+	}
+
+	if (doc->scmd == NULL)
+		return true;
+
+	copy = (char *) arenaAlloc(ctx, len);
+	memcpy(copy, line, len);
+	text = copy;
+
+	/* literal runs and $name parts, as in a double quoted string */
+	start = 0;
+	for (i = 0; doc->expand && (i + 1 < len); i++) {
+		if ((text[i] != '$') || !((text[i + 1] == '_') || isalpha((unsigned char)text[i + 1])))
+			continue;
+
+		for (end = i + 2; (end < len) && ((text[end] == '_') || isalnum((unsigned char)text[end])); end++)
+			;
+		if (i > start)
+			add_body_part(ctx, doc, text + start, i - start, false);
+		add_body_part(ctx, doc, text + i + 1, end - i - 1, true);
+		start = end;
+		i = end - 1;
+	}
+	if (len > start)
+		add_body_part(ctx, doc, text + start, len - start, false);
+	add_body_part(ctx, doc, "\n", 1, false);
 
 	return true;
 }
 
 
-void free_parse_memory()
+static parser_ctx_t * getDefaultCtx(void)
 {
-	if (needsFree) {
-		globalEndParsing();
-		while (globalAllocCount != 0) {
-			globalAllocCount--;
-			assert(globalAllocMem[globalAllocCount] != NULL);
-			free(globalAllocMem[globalAllocCount]);
-			globalAllocMem[globalAllocCount] = NULL;
-		}
+	if (defaultCtx == NULL)
+		defaultCtx = parser_ctx_create();
+
+	return defaultCtx;
+}
 
-		if (globalAllocMem != NULL) {
-			free((void *)globalAllocMem);
-			globalAllocMem = NULL;
-		}
 
-		globalAllocSize = 0;
-		needsFree = false;
+bool parse_line(const char * line, command_t ** root)
+{
+	if (line == NULL) {
+		/* see the comment in parser.h */
+		assert(false);
+		return false;
 	}
+
+	return parse_line_r(getDefaultCtx(), line, strlen(line), root);
+}
+
+
+bool parse_line_buffer(char * buf, size_t len, command_t ** root)
+{
+	return parse_line_buffer_r(getDefaultCtx(), buf, len, root);
+}
+
+
+void free_parse_memory()
+{
+	if (defaultCtx != NULL)
+		free_parse_memory_r(defaultCtx);
 }
 
 
-void yyerror(const char* str)
+void yyerror(YYLTYPE * llocp, parser_ctx_t * ctx, void * scanner, const char * str)
 {
-	parse_error(str, yylloc.first_column);
+	(void) scanner;
+	parse_error(str, ctx->columnOffset + llocp->first_column);
 }